@@ -15,4 +15,14 @@ void inline warn(const char* msg)
     std::cerr << "[WARNING]: " << msg << std::endl;
 }
 
+void inline info(const std::string&& msg)
+{
+    std::cout << "[INFO]: " << msg << std::endl;
+}
+
+void inline info(const char* msg)
+{
+    std::cout << "[INFO]: " << msg << std::endl;
+}
+
 #endif
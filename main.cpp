@@ -11,6 +11,7 @@ auto main(int, char**) -> int {
 
         auto stop = false;
         while(!stop) {
+            render.WaitFrame();
             auto event = window.HandleEvents();
 
             if(event.type == Event::Type::WindowQuit)
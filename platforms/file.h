@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. The view is page aligned, so it can be handed to Vulkan as SPIR-V words directly.
+class MappedFile
+{
+private:
+    const void* data = nullptr;
+    size_t size = 0;
+    void* file = nullptr;
+    void* mapping = nullptr;
+public:
+
+    MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const void* Data()
+    {
+        return data;
+    }
+
+    size_t Size()
+    {
+        return size;
+    }
+
+    ~MappedFile();
+};
+
+// Writes path through a temporary file that reaches the disk before it replaces path, so neither a crash nor a power
+// loss leaves a truncated file behind.
+void WriteFileDurable(const std::string& path, const void* data, size_t size);
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <unordered_map>
 #include "window.h"
+#include "file.h"
 
 
 #include "vulkan/vulkan.hpp"
@@ -229,3 +230,70 @@ Window WindowBuilder::Build()
 }
 
 
+MappedFile::MappedFile(const std::string& path)
+{
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        throw(std::exception(("File not found: " + path + ".").data()));
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        throw(std::exception(("Unable to map empty file: " + path + ".").data()));
+    }
+    size = (size_t)file_size.QuadPart;
+
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+    {
+        auto message = get_error_message();
+        CloseHandle(file);
+        throw(std::exception(message.c_str()));
+    }
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        auto message = get_error_message();
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw(std::exception(message.c_str()));
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+
+void WriteFileDurable(const std::string& path, const void* data, size_t size)
+{
+    auto tmp = path + ".tmp";
+    auto file = CreateFileA(tmp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw(std::exception(("Unable to create file: " + tmp + ".").data()));
+    }
+
+    DWORD written = 0;
+    if (!WriteFile(file, data, (DWORD)size, &written, NULL) || written != size || !FlushFileBuffers(file))
+    {
+        auto message = get_error_message();
+        CloseHandle(file);
+        DeleteFileA(tmp.c_str());
+        throw(std::exception(message.c_str()));
+    }
+    CloseHandle(file);
+
+    // Write-through so the rename itself is on disk once this returns.
+    if (!MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        throw(std::exception(get_error_message().c_str()));
+    }
+}
@@ -0,0 +1,493 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+enum class MemoryUsage
+{
+    GPU_ONLY,
+    // Written by the CPU every frame, device local when the device has host visible VRAM.
+    CPU_TO_GPU,
+    // Read back by the CPU. Always coherent, so mapped reads need no invalidate, and cached where the device has it.
+    GPU_TO_CPU,
+    CPU_ONLY,
+};
+
+struct HeapStats
+{
+    public:
+    vk::DeviceSize size = 0;
+    // Device memory allocated from the heap, blocks and dedicated allocations.
+    vk::DeviceSize reserved = 0;
+    // Bytes handed out to resources.
+    vk::DeviceSize used = 0;
+    uint64_t allocations = 0;
+    uint64_t blocks = 0;
+    uint64_t dedicated = 0;
+};
+
+namespace inner
+{
+    // Two level segregated fit over one range of offsets. Free ranges are kept in lists by size class, found
+    // through two bitmaps and merged with their neighbours on free, so both directions are O(1).
+    class Tlsf
+    {
+        public:
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        private:
+        static constexpr uint32_t SL_BITS = 4;
+        static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+        static constexpr uint32_t FL_COUNT = 64;
+        static constexpr vk::DeviceSize MIN_SPLIT = 256;
+
+        struct Node
+        {
+            vk::DeviceSize offset = 0;
+            vk::DeviceSize size = 0;
+            uint32_t prev = NONE;
+            uint32_t next = NONE;
+            uint32_t prev_free = NONE;
+            uint32_t next_free = NONE;
+            bool free = false;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> unused;
+        uint64_t fl_bitmap = 0;
+        std::array<uint32_t, FL_COUNT> sl_bitmap = {};
+        std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> heads;
+        vk::DeviceSize used = 0;
+
+        static std::pair<uint32_t, uint32_t> Mapping(vk::DeviceSize size)
+        {
+            if (size < SL_COUNT)
+            {
+                return {0, static_cast<uint32_t>(size)};
+            }
+            auto fl = static_cast<uint32_t>(std::bit_width(size)) - 1;
+            auto sl = static_cast<uint32_t>(size >> (fl - SL_BITS)) ^ SL_COUNT;
+            return {fl - SL_BITS + 1, sl};
+        }
+
+        // Rounds up to the next size class, so every range in the class found is large enough.
+        static std::pair<uint32_t, uint32_t> SearchMapping(vk::DeviceSize size)
+        {
+            if (size >= SL_COUNT)
+            {
+                size += (vk::DeviceSize(1) << (std::bit_width(size) - 1 - SL_BITS)) - 1;
+            }
+            return Mapping(size);
+        }
+
+        uint32_t NewNode()
+        {
+            if (!unused.empty())
+            {
+                auto index = unused.back();
+                unused.pop_back();
+                nodes[index] = Node();
+                return index;
+            }
+            nodes.emplace_back();
+            return static_cast<uint32_t>(nodes.size() - 1);
+        }
+
+        void Insert(uint32_t index)
+        {
+            auto [fl, sl] = Mapping(nodes[index].size);
+            auto head = heads[fl][sl];
+            nodes[index].free = true;
+            nodes[index].prev_free = NONE;
+            nodes[index].next_free = head;
+            if (head != NONE)
+                nodes[head].prev_free = index;
+            heads[fl][sl] = index;
+            fl_bitmap |= uint64_t(1) << fl;
+            sl_bitmap[fl] |= 1u << sl;
+        }
+
+        void Remove(uint32_t index)
+        {
+            auto& node = nodes[index];
+            auto [fl, sl] = Mapping(node.size);
+            if (node.prev_free != NONE)
+                nodes[node.prev_free].next_free = node.next_free;
+            else
+                heads[fl][sl] = node.next_free;
+            if (node.next_free != NONE)
+                nodes[node.next_free].prev_free = node.prev_free;
+            if (heads[fl][sl] == NONE)
+            {
+                sl_bitmap[fl] &= ~(1u << sl);
+                if (!sl_bitmap[fl])
+                    fl_bitmap &= ~(uint64_t(1) << fl);
+            }
+            node.free = false;
+        }
+
+        // Absorbs the node after first into first.
+        void Merge(uint32_t first, uint32_t second)
+        {
+            nodes[first].size += nodes[second].size;
+            nodes[first].next = nodes[second].next;
+            if (nodes[second].next != NONE)
+                nodes[nodes[second].next].prev = first;
+            unused.push_back(second);
+        }
+
+        // Splits size bytes off the front of index, the rest becomes a new free node after it.
+        void Split(uint32_t index, vk::DeviceSize size)
+        {
+            auto rest = NewNode();
+            nodes[rest].offset = nodes[index].offset + size;
+            nodes[rest].size = nodes[index].size - size;
+            nodes[rest].prev = index;
+            nodes[rest].next = nodes[index].next;
+            if (nodes[index].next != NONE)
+                nodes[nodes[index].next].prev = rest;
+            nodes[index].next = rest;
+            nodes[index].size = size;
+            Insert(rest);
+        }
+
+        public:
+        Tlsf(vk::DeviceSize size)
+        {
+            for (auto& h : heads)
+                h.fill(NONE);
+            auto index = NewNode();
+            nodes[index].size = size;
+            Insert(index);
+        }
+
+        // Returns the offset and the node to free it with.
+        std::optional<std::pair<vk::DeviceSize, uint32_t>> Allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+        {
+            auto [fl, sl] = SearchMapping(size + alignment - 1);
+            if (fl >= FL_COUNT)
+                return std::nullopt;
+            auto sl_map = sl_bitmap[fl] & (~0u << sl);
+            if (!sl_map)
+            {
+                auto fl_map = fl + 1 < FL_COUNT ? fl_bitmap & (~uint64_t(0) << (fl + 1)) : 0;
+                if (!fl_map)
+                    return std::nullopt;
+                fl = std::countr_zero(fl_map);
+                sl_map = sl_bitmap[fl];
+            }
+            sl = std::countr_zero(sl_map);
+
+            auto index = heads[fl][sl];
+            Remove(index);
+
+            auto aligned = (nodes[index].offset + alignment - 1) / alignment * alignment;
+            if (auto padding = aligned - nodes[index].offset)
+            {
+                // The padding stays a free node of its own, its previous neighbour is in use.
+                Split(index, padding);
+                auto front = index;
+                index = nodes[front].next;
+                Remove(index);
+                Insert(front);
+            }
+            if (nodes[index].size - size >= MIN_SPLIT)
+            {
+                Split(index, size);
+            }
+            used += nodes[index].size;
+            return std::pair(nodes[index].offset, index);
+        }
+
+        void Free(uint32_t index)
+        {
+            used -= nodes[index].size;
+            auto prev = nodes[index].prev;
+            if (prev != NONE && nodes[prev].free)
+            {
+                Remove(prev);
+                Merge(prev, index);
+                index = prev;
+            }
+            auto next = nodes[index].next;
+            if (next != NONE && nodes[next].free)
+            {
+                Remove(next);
+                Merge(index, next);
+            }
+            Insert(index);
+        }
+
+        auto Used()
+        {
+            return used;
+        }
+    };
+
+    struct MemoryBlock
+    {
+        vk::DeviceMemory memory;
+        uint8_t* mapped = nullptr;
+        vk::DeviceSize size = 0;
+        Tlsf tlsf;
+
+        MemoryBlock(vk::DeviceMemory memory, uint8_t* mapped, vk::DeviceSize size):
+        memory(memory), mapped(mapped), size(size), tlsf(size)
+        {}
+    };
+
+    struct Allocation
+    {
+        vk::DeviceMemory memory;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        // Persistently mapped for host visible memory, nullptr otherwise.
+        uint8_t* mapped = nullptr;
+        uint32_t type = 0;
+        bool linear = true;
+        // nullptr for dedicated allocations.
+        MemoryBlock* block = nullptr;
+        uint32_t node = Tlsf::NONE;
+    };
+
+    // Sub-allocates buffers and images from large vk::DeviceMemory blocks, one set of blocks per memory type.
+    // When bufferImageGranularity is above 1, linear and optimal resources get separate blocks so they never share a page.
+    class MemoryAllocator
+    {
+        private:
+        struct Pool
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<MemoryBlock>> blocks;
+        };
+        struct HeapCounters
+        {
+            std::atomic<vk::DeviceSize> reserved = 0;
+            std::atomic<vk::DeviceSize> used = 0;
+            std::atomic<uint64_t> allocations = 0;
+            std::atomic<uint64_t> blocks = 0;
+            std::atomic<uint64_t> dedicated = 0;
+        };
+
+        vk::Device device;
+        vk::PhysicalDeviceMemoryProperties properties;
+        vk::DeviceSize block_size;
+        bool separate_linear;
+        std::array<Pool, VK_MAX_MEMORY_TYPES * 2> pools;
+        std::array<HeapCounters, VK_MAX_MEMORY_HEAPS> heaps;
+
+        Pool& GetPool(uint32_t type, bool linear)
+        {
+            return pools[type * 2 + (separate_linear && linear ? 1 : 0)];
+        }
+
+        auto& Heap(uint32_t type)
+        {
+            return heaps[properties.memoryTypes[type].heapIndex];
+        }
+
+        uint8_t* Map(vk::DeviceMemory memory, uint32_t type, vk::DeviceSize size)
+        {
+            if (properties.memoryTypes[type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+            {
+                return static_cast<uint8_t*>(device.mapMemory(memory, 0, size));
+            }
+            return nullptr;
+        }
+
+        std::optional<uint32_t> FindType(uint32_t bits, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred)
+        {
+            std::optional<uint32_t> fallback;
+            for (uint32_t x = 0; x < properties.memoryTypeCount; x++)
+            {
+                auto flags = properties.memoryTypes[x].propertyFlags;
+                if (!(bits & (1u << x)) || (flags & required) != required)
+                    continue;
+                if ((flags & preferred) == preferred)
+                    return x;
+                if (!fallback)
+                    fallback = x;
+            }
+            return fallback;
+        }
+
+        uint32_t SelectType(uint32_t bits, MemoryUsage usage)
+        {
+            std::optional<uint32_t> type;
+            switch (usage)
+            {
+                case MemoryUsage::GPU_ONLY:
+                    type = FindType(bits, vk::MemoryPropertyFlagBits::eDeviceLocal, {});
+                    if (!type)
+                        type = FindType(bits, {}, {});
+                    break;
+                case MemoryUsage::CPU_TO_GPU:
+                    type = FindType(bits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, vk::MemoryPropertyFlagBits::eDeviceLocal);
+                    break;
+                case MemoryUsage::GPU_TO_CPU:
+                    type = FindType(bits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, vk::MemoryPropertyFlagBits::eHostCached);
+                    break;
+                case MemoryUsage::CPU_ONLY:
+                    type = FindType(bits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, {});
+                    break;
+            }
+            if (!type)
+            {
+                throw(std::exception("No memory type matches the resource and usage"));
+            }
+            return *type;
+        }
+
+        Allocation AllocateDedicated(vk::MemoryRequirements requirements, uint32_t type, bool linear, vk::Buffer buffer, vk::Image image)
+        {
+            auto dedicated = vk::MemoryDedicatedAllocateInfo()
+                .setBuffer(buffer)
+                .setImage(image);
+            auto memory = device.allocateMemory(
+                vk::MemoryAllocateInfo()
+                    .setPNext(&dedicated)
+                    .setAllocationSize(requirements.size)
+                    .setMemoryTypeIndex(type)
+            );
+            auto& heap = Heap(type);
+            heap.reserved += requirements.size;
+            heap.used += requirements.size;
+            heap.allocations++;
+            heap.dedicated++;
+
+            Allocation allocation;
+            allocation.memory = memory;
+            allocation.size = requirements.size;
+            allocation.mapped = Map(memory, type, requirements.size);
+            allocation.type = type;
+            allocation.linear = linear;
+            return allocation;
+        }
+
+        public:
+        MemoryAllocator(vk::Device device, vk::PhysicalDevice physical, vk::DeviceSize block_size):
+        device(device), properties(physical.getMemoryProperties()), block_size(block_size)
+        {
+            separate_linear = physical.getProperties().limits.bufferImageGranularity > 1;
+        }
+
+        ~MemoryAllocator()
+        {
+            for (auto& pool : pools)
+            {
+                for (auto& block : pool.blocks)
+                {
+                    device.freeMemory(block->memory);
+                }
+            }
+        }
+
+        // linear is true for buffers and linear images. Resources the driver wants on their own, or larger than half
+        // a block, get a dedicated allocation.
+        Allocation Allocate(vk::MemoryRequirements requirements, MemoryUsage usage, bool linear, bool dedicated = false, vk::Buffer buffer = {}, vk::Image image = {})
+        {
+            auto type = SelectType(requirements.memoryTypeBits, usage);
+            if (dedicated || requirements.size > block_size / 2)
+            {
+                return AllocateDedicated(requirements, type, linear, buffer, image);
+            }
+
+            auto& pool = GetPool(type, linear);
+            auto& heap = Heap(type);
+            std::lock_guard lock(pool.mutex);
+            std::optional<std::pair<vk::DeviceSize, uint32_t>> found;
+            MemoryBlock* block = nullptr;
+            for (auto& b : pool.blocks)
+            {
+                if ((found = b->tlsf.Allocate(requirements.size, requirements.alignment)))
+                {
+                    block = b.get();
+                    break;
+                }
+            }
+            if (!found)
+            {
+                auto memory = device.allocateMemory(
+                    vk::MemoryAllocateInfo()
+                        .setAllocationSize(block_size)
+                        .setMemoryTypeIndex(type)
+                );
+                pool.blocks.push_back(std::make_unique<MemoryBlock>(memory, Map(memory, type, block_size), block_size));
+                heap.reserved += block_size;
+                heap.blocks++;
+                block = pool.blocks.back().get();
+                found = block->tlsf.Allocate(requirements.size, requirements.alignment);
+                // Only an alignment larger than the rest of the block can fail here.
+                if (!found)
+                {
+                    throw(std::exception("Allocation does not fit into a fresh memory block"));
+                }
+            }
+            heap.used += requirements.size;
+            heap.allocations++;
+
+            Allocation allocation;
+            allocation.memory = block->memory;
+            allocation.offset = found->first;
+            allocation.size = requirements.size;
+            allocation.mapped = block->mapped ? block->mapped + found->first : nullptr;
+            allocation.type = type;
+            allocation.linear = linear;
+            allocation.block = block;
+            allocation.node = found->second;
+            return allocation;
+        }
+
+        // Empty blocks are released except the last one left in the pool, which is kept to absorb churn.
+        void Free(const Allocation& allocation)
+        {
+            auto& heap = Heap(allocation.type);
+            heap.used -= allocation.size;
+            heap.allocations--;
+            if (!allocation.block)
+            {
+                heap.reserved -= allocation.size;
+                heap.dedicated--;
+                device.freeMemory(allocation.memory);
+                return;
+            }
+
+            auto& pool = GetPool(allocation.type, allocation.linear);
+            std::lock_guard lock(pool.mutex);
+            allocation.block->tlsf.Free(allocation.node);
+            if (allocation.block->tlsf.Used() == 0 && pool.blocks.size() > 1)
+            {
+                auto block = std::find_if(pool.blocks.begin(), pool.blocks.end(), [&](auto& b) { return b.get() == allocation.block; });
+                device.freeMemory((*block)->memory);
+                pool.blocks.erase(block);
+                heap.reserved -= block_size;
+                heap.blocks--;
+            }
+        }
+
+        std::vector<HeapStats> GetStats()
+        {
+            std::vector<HeapStats> stats;
+            for (uint32_t x = 0; x < properties.memoryHeapCount; x++)
+            {
+                HeapStats heap;
+                heap.size = properties.memoryHeaps[x].size;
+                heap.reserved = heaps[x].reserved;
+                heap.used = heaps[x].used;
+                heap.allocations = heaps[x].allocations;
+                heap.blocks = heaps[x].blocks;
+                heap.dedicated = heaps[x].dedicated;
+                stats.push_back(heap);
+            }
+            return stats;
+        }
+    };
+};
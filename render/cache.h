@@ -0,0 +1,243 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+#include "../log/log.h"
+#include "../platforms/file.h"
+
+struct PipelineCacheStats
+{
+    public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    std::chrono::nanoseconds hit_time{0};
+    std::chrono::nanoseconds miss_time{0};
+    // Average miss from earlier runs, saved along with the cache.
+    std::chrono::nanoseconds miss_cost{0};
+
+    auto Total()
+    {
+        return hits + misses;
+    }
+
+    // Estimated compile time avoided: every hit would otherwise have cost an average miss. A warm start may
+    // have no misses of its own, then the average from earlier runs stands in.
+    auto TimeSaved()
+    {
+        if (hits == 0)
+        {
+            return std::chrono::nanoseconds(0);
+        }
+        auto miss = misses > 0 ? miss_time / (int64_t)misses : miss_cost;
+        auto hit = hit_time / (int64_t)hits;
+        return miss > hit ? (miss - hit) * (int64_t)hits : std::chrono::nanoseconds(0);
+    }
+};
+
+namespace inner
+{
+    class PipelineCache : public vk::PipelineCache
+    {
+        private:
+        // Written ahead of the driver's data. Files without it are read as a bare driver blob.
+        struct Header
+        {
+            uint32_t magic = 0x53435056;
+            uint32_t version = 1;
+            uint64_t misses = 0;
+            int64_t miss_time = 0;
+        };
+
+        vk::Device device;
+        vk::PhysicalDeviceProperties properties;
+        std::filesystem::path path;
+        // Hits and misses are only classified when VK_EXT_pipeline_creation_feedback is enabled.
+        bool feedback;
+
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<int64_t> hit_time = 0;
+        std::atomic<int64_t> miss_time = 0;
+        // Totals of all earlier runs, read from the header.
+        uint64_t saved_misses = 0;
+        int64_t saved_miss_time = 0;
+
+        std::vector<char> Load()
+        {
+            std::vector<char> blob;
+            if (path.empty() || !std::filesystem::exists(path))
+            {
+                return blob;
+            }
+
+            auto file = std::ifstream(path, std::ios::ate | std::ios::binary);
+            if (!file.is_open())
+            {
+                return blob;
+            }
+            blob.resize((size_t)file.tellg());
+            file.seekg(0);
+            file.read(blob.data(), blob.size());
+
+            Header header;
+            if (file && blob.size() >= sizeof(header))
+            {
+                std::memcpy(&header, blob.data(), sizeof(header));
+                if (header.magic == Header().magic && header.version == Header().version)
+                {
+                    saved_misses = header.misses;
+                    saved_miss_time = header.miss_time;
+                    blob.erase(blob.begin(), blob.begin() + sizeof(header));
+                }
+            }
+
+            if (!file || !Validate(blob))
+            {
+                warn("Discarding incompatible pipeline cache: " + path.string());
+                blob.clear();
+            }
+            return blob;
+        }
+
+        bool Validate(const std::vector<char>& blob)
+        {
+            VkPipelineCacheHeaderVersionOne header;
+            if (blob.size() < sizeof(header))
+            {
+                return false;
+            }
+            std::memcpy(&header, blob.data(), sizeof(header));
+
+            return header.headerSize >= sizeof(header)
+                && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+                && header.vendorID == properties.vendorID
+                && header.deviceID == properties.deviceID
+                && std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+        }
+
+        void Record(const vk::PipelineCreationFeedbackEXT& result, std::chrono::nanoseconds elapsed)
+        {
+            if (!(result.flags & vk::PipelineCreationFeedbackFlagBitsEXT::eValid))
+            {
+                return;
+            }
+            auto duration = result.duration > 0 ? (int64_t)result.duration : elapsed.count();
+            if (result.flags & vk::PipelineCreationFeedbackFlagBitsEXT::eApplicationPipelineCacheHit)
+            {
+                hits++;
+                hit_time += duration;
+            }
+            else
+            {
+                misses++;
+                miss_time += duration;
+            }
+        }
+
+        template <typename T, typename F>
+        auto Create(T info, uint32_t stages, F create)
+        {
+            vk::PipelineCreationFeedbackEXT result;
+            std::vector<vk::PipelineCreationFeedbackEXT> stage_results(stages);
+            auto feedback_info = vk::PipelineCreationFeedbackCreateInfoEXT()
+                .setPNext(info.pNext)
+                .setPPipelineCreationFeedback(&result)
+                .setPipelineStageCreationFeedbacks(stage_results);
+            if (feedback)
+            {
+                info.setPNext(&feedback_info);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto pipeline = create(info);
+            Record(result, std::chrono::steady_clock::now() - start);
+
+            return pipeline;
+        }
+
+        public:
+        PipelineCache(vk::Device device, vk::PhysicalDevice physical, std::filesystem::path path, bool feedback):
+        device(device), properties(physical.getProperties()), path(path), feedback(feedback)
+        {
+            auto blob = Load();
+            static_cast<vk::PipelineCache&>(*this) = device.createPipelineCache(
+                vk::PipelineCacheCreateInfo()
+                .setInitialDataSize(blob.size())
+                .setPInitialData(blob.data())
+            );
+        }
+
+        ~PipelineCache()
+        {
+            try
+            {
+                Save();
+            }
+            catch (std::exception& e)
+            {
+                warn(e.what());
+            }
+
+            auto stats = GetStats();
+            if (stats.Total() > 0)
+            {
+                info("Pipeline cache: " + std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) + " misses, "
+                    + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(stats.TimeSaved()).count()) + "ms saved");
+            }
+            device.destroyPipelineCache(*this);
+        }
+
+        // Written durably, so neither a crash nor a power loss leaves a truncated blob behind.
+        void Save()
+        {
+            if (path.empty())
+            {
+                return;
+            }
+            auto blob = device.getPipelineCacheData(*this);
+            Header header;
+            header.misses = saved_misses + misses;
+            header.miss_time = saved_miss_time + miss_time;
+
+            std::vector<uint8_t> data(sizeof(header) + blob.size());
+            std::memcpy(data.data(), &header, sizeof(header));
+            std::memcpy(data.data() + sizeof(header), blob.data(), blob.size());
+            WriteFileDurable(path.string(), data.data(), data.size());
+        }
+
+        auto CreateGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& info)
+        {
+            return Create(info, info.stageCount, [&](const vk::GraphicsPipelineCreateInfo& i) {
+                return device.createGraphicsPipeline(*this, i).value;
+            });
+        }
+
+        auto CreateComputePipeline(const vk::ComputePipelineCreateInfo& info)
+        {
+            return Create(info, 1, [&](const vk::ComputePipelineCreateInfo& i) {
+                return device.createComputePipeline(*this, i).value;
+            });
+        }
+
+        PipelineCacheStats GetStats()
+        {
+            PipelineCacheStats stats;
+            stats.hits = hits;
+            stats.misses = misses;
+            stats.hit_time = std::chrono::nanoseconds(hit_time.load());
+            stats.miss_time = std::chrono::nanoseconds(miss_time.load());
+            if (saved_misses > 0)
+            {
+                stats.miss_cost = std::chrono::nanoseconds(saved_miss_time / (int64_t)saved_misses);
+            }
+            return stats;
+        }
+    };
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+
+#include "pool.h"
+#include "submit.h"
+
+// One compute pipeline with its resources and a list of dispatches, recorded in order with a barrier before each
+// of them. The first one orders the job after everything submitted to the queue before it, so jobs on the same
+// ComputeContext see each other's writes without passing tokens around. Buffers shared with the graphics queue should be created with concurrent sharing, or be handed over
+// with an ownership transfer by whoever records the other side.
+class ComputeJob
+{
+    private:
+    struct Write
+    {
+        uint32_t set;
+        uint32_t binding;
+        vk::DescriptorType type;
+        std::optional<vk::DescriptorBufferInfo> buffer;
+        std::optional<vk::DescriptorImageInfo> image;
+    };
+    struct DispatchCommand
+    {
+        std::array<uint32_t, 3> groups;
+        vk::Buffer indirect;
+        vk::DeviceSize offset;
+    };
+
+    Pipeline m_Pipeline;
+    std::vector<Write> m_Writes;
+    std::map<uint32_t, vk::DescriptorSet> m_Sets;
+    std::vector<uint8_t> m_PushConstants;
+    uint32_t m_PushOffset = 0;
+    std::vector<DispatchCommand> m_Dispatches;
+    std::vector<std::pair<SyncToken, vk::PipelineStageFlags>> m_Waits;
+    public:
+    ComputeJob(Pipeline pipeline):
+    m_Pipeline(pipeline)
+    {}
+
+    auto BindBuffer(uint32_t set, uint32_t binding, vk::DescriptorBufferInfo buffer, vk::DescriptorType type = vk::DescriptorType::eStorageBuffer)
+    {
+        m_Writes.push_back({set, binding, type, buffer, std::nullopt});
+        return *this;
+    }
+
+    auto BindImage(uint32_t set, uint32_t binding, vk::DescriptorImageInfo image, vk::DescriptorType type = vk::DescriptorType::eStorageImage)
+    {
+        m_Writes.push_back({set, binding, type, std::nullopt, image});
+        return *this;
+    }
+
+    // A set allocated elsewhere, used as is instead of one built from BindBuffer/BindImage.
+    auto BindSet(uint32_t set, vk::DescriptorSet descriptor_set)
+    {
+        m_Sets[set] = descriptor_set;
+        return *this;
+    }
+
+    template <typename T>
+    auto PushConstants(const T& value, uint32_t offset = 0) requires std::is_trivially_copyable_v<T>
+    {
+        m_PushConstants.resize(sizeof(T));
+        std::memcpy(m_PushConstants.data(), &value, sizeof(T));
+        m_PushOffset = offset;
+        return *this;
+    }
+
+    auto Dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1)
+    {
+        m_Dispatches.push_back({{x, y, z}, nullptr, 0});
+        return *this;
+    }
+
+    // The group counts come from a vk::DispatchIndirectCommand in buffer, which may have been written by an earlier
+    // dispatch or an earlier job on the same context. Writes from other queues need a Wait.
+    auto DispatchIndirect(vk::Buffer buffer, vk::DeviceSize offset = 0)
+    {
+        m_Dispatches.push_back({{0, 0, 0}, buffer, offset});
+        return *this;
+    }
+
+    // Work on another queue that has to finish before the given stage of this job, e.g. a graphics frame writing the input.
+    auto Wait(SyncToken token, vk::PipelineStageFlags stage = vk::PipelineStageFlagBits::eComputeShader)
+    {
+        m_Waits.emplace_back(token, stage);
+        return *this;
+    }
+
+    const auto& Waits()
+    {
+        return m_Waits;
+    }
+
+    // Sets for BindBuffer/BindImage come from descriptor_pool, using the layouts the pipeline layout was created with.
+    auto Record(inner::CommandBuffer& buffer, Device device, vk::DescriptorPool descriptor_pool)
+    {
+        std::map<uint32_t, std::vector<Write*>> writes;
+        for (auto& write : m_Writes)
+        {
+            writes[write.set].push_back(&write);
+        }
+
+        auto sets = m_Sets;
+        if (!writes.empty())
+        {
+            auto layouts = device->GetLayoutCache().GetSetLayouts(m_Pipeline->Layout());
+            std::vector<vk::WriteDescriptorSet> descriptor_writes;
+            for (auto& [set, set_writes] : writes)
+            {
+                if (set >= layouts.size())
+                {
+                    throw(std::exception("Compute job binds a set the pipeline layout does not have"));
+                }
+                auto allocated = device->allocateDescriptorSets(
+                    vk::DescriptorSetAllocateInfo()
+                        .setDescriptorPool(descriptor_pool)
+                        .setSetLayouts(layouts[set])
+                ).front();
+                sets[set] = allocated;
+                for (auto write : set_writes)
+                {
+                    auto descriptor_write = vk::WriteDescriptorSet()
+                        .setDstSet(allocated)
+                        .setDstBinding(write->binding)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(write->type);
+                    if (write->buffer)
+                        descriptor_write.setPBufferInfo(&*write->buffer);
+                    else
+                        descriptor_write.setPImageInfo(&*write->image);
+                    descriptor_writes.push_back(descriptor_write);
+                }
+            }
+            device->updateDescriptorSets(descriptor_writes, {});
+        }
+
+        buffer.bindPipeline(m_Pipeline);
+        for (auto& [set, descriptor_set] : sets)
+        {
+            buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_Pipeline->Layout(), set, descriptor_set, {});
+        }
+        if (!m_PushConstants.empty())
+        {
+            buffer.pushConstants(m_Pipeline->Layout(), vk::ShaderStageFlagBits::eCompute, m_PushOffset, static_cast<uint32_t>(m_PushConstants.size()), m_PushConstants.data());
+        }
+        for (auto& dispatch : m_Dispatches)
+        {
+            // Before the first dispatch the source scope is the queue's earlier submissions.
+            buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eComputeShader,
+                vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+                {},
+                vk::MemoryBarrier()
+                    .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                    .setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead),
+                {}, {});
+            if (dispatch.indirect)
+                buffer.dispatchIndirect(dispatch.indirect, dispatch.offset);
+            else
+                buffer.dispatch(dispatch.groups[0], dispatch.groups[1], dispatch.groups[2]);
+        }
+        return !writes.empty();
+    }
+};
+
+namespace inner
+{
+    // Records and submits ComputeJobs on one queue. Command buffers and descriptor pools are recycled once the
+    // queue's timeline shows their submission finished, nothing here waits on the device.
+    class ComputeContext
+    {
+        private:
+        struct InFlight
+        {
+            uint64_t value;
+            std::shared_ptr<CommandBuffer> buffer;
+            vk::DescriptorPool descriptor_pool;
+            ComputeJob job;
+        };
+
+        Queue queue;
+        std::shared_ptr<CommandPool> pool;
+        std::deque<InFlight> in_flight;
+        std::vector<std::shared_ptr<CommandBuffer>> free_buffers;
+        std::vector<vk::DescriptorPool> free_pools;
+        std::vector<vk::DescriptorPool> descriptor_pools;
+        std::mutex mutex;
+
+        void Retire()
+        {
+            auto completed = queue.Timeline()->Completed();
+            while (!in_flight.empty() && in_flight.front().value <= completed)
+            {
+                auto& done = in_flight.front();
+                free_buffers.push_back(done.buffer);
+                if (done.descriptor_pool)
+                {
+                    queue.Device()->resetDescriptorPool(done.descriptor_pool);
+                    free_pools.push_back(done.descriptor_pool);
+                }
+                in_flight.pop_front();
+            }
+        }
+
+        vk::DescriptorPool GetDescriptorPool()
+        {
+            if (!free_pools.empty())
+            {
+                auto descriptor_pool = free_pools.back();
+                free_pools.pop_back();
+                return descriptor_pool;
+            }
+            const std::array<vk::DescriptorPoolSize, 5> sizes =
+            {
+                vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 64),
+                vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 64),
+                vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 64),
+                vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage, 64),
+                vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 64),
+            };
+            auto descriptor_pool = queue.Device()->createDescriptorPool(
+                vk::DescriptorPoolCreateInfo()
+                    .setMaxSets(16)
+                    .setPoolSizes(sizes)
+            );
+            descriptor_pools.push_back(descriptor_pool);
+            return descriptor_pool;
+        }
+
+        public:
+        ComputeContext(Queue queue, std::shared_ptr<CommandPool> pool):
+        queue(queue), pool(pool)
+        {}
+
+        ~ComputeContext()
+        {
+            queue.Timeline()->Wait(queue.Timeline()->Last());
+            for (auto descriptor_pool : descriptor_pools)
+            {
+                queue.Device()->destroyDescriptorPool(descriptor_pool);
+            }
+        }
+
+        SyncToken Submit(ComputeJob job)
+        {
+            std::lock_guard lock(mutex);
+            Retire();
+
+            std::shared_ptr<CommandBuffer> buffer;
+            if (!free_buffers.empty())
+            {
+                buffer = free_buffers.back();
+                free_buffers.pop_back();
+            }
+            else
+            {
+                buffer = std::make_shared<CommandBuffer>(
+                    queue.Device()->allocateCommandBuffers(
+                        vk::CommandBufferAllocateInfo()
+                            .setCommandPool(*pool)
+                            .setCommandBufferCount(1)
+                            .setLevel(vk::CommandBufferLevel::ePrimary)
+                    ).front(), *pool);
+            }
+            auto descriptor_pool = GetDescriptorPool();
+
+            buffer->begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            auto used = job.Record(*buffer, queue.Device(), descriptor_pool);
+            buffer->end();
+            if (!used)
+            {
+                free_pools.push_back(descriptor_pool);
+                descriptor_pool = nullptr;
+            }
+
+            auto submit = SubmitBuilder().AddCommandBuffer(*buffer);
+            for (auto& [token, stage] : job.Waits())
+            {
+                submit = submit.AddWait(token, stage);
+            }
+            auto token = submit.Submit(queue);
+            in_flight.push_back({token.value, buffer, descriptor_pool, std::move(job)});
+            return token;
+        }
+    };
+};
+
+using ComputeContext = std::shared_ptr<inner::ComputeContext>;
+
+class ComputeContextBuilder
+{
+    public:
+    // Falls back to the general family when DeviceBuilder found no dedicated compute family, the API stays the same.
+    auto Build(Queue queue)
+    {
+        return std::make_shared<inner::ComputeContext>(queue, CommandPoolBuilder().Build(queue));
+    }
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "vulkan/vulkan.hpp"
+
+namespace inner
+{
+    class Timeline;
+
+    // Runs destroy callbacks once the GPU can no longer be using what they destroy. Push records the last value
+    // submitted to every registered timeline, the entry runs from Collect once all of them have been reached.
+    // Timelines are held weakly since they keep the device alive, a timeline that is gone counts as reached.
+    template <typename T>
+    class DeletionQueueBase
+    {
+        private:
+        struct Entry
+        {
+            std::vector<uint64_t> values;
+            std::function<void()> destroy;
+        };
+
+        std::vector<std::weak_ptr<T>> timelines;
+        std::deque<Entry> entries;
+        std::mutex mutex;
+
+        bool Reached(const std::vector<uint64_t>& values, const std::vector<uint64_t>& completed)
+        {
+            for (size_t x = 0; x < values.size(); x++)
+            {
+                if (values[x] > completed[x])
+                    return false;
+            }
+            return true;
+        }
+
+        std::vector<uint64_t> Values(bool submitted)
+        {
+            std::vector<uint64_t> values;
+            for (auto& weak : timelines)
+            {
+                auto timeline = weak.lock();
+                values.push_back(!timeline ? 0 : submitted ? timeline->Last() : timeline->Completed());
+            }
+            return values;
+        }
+
+        public:
+        void Register(std::shared_ptr<T> timeline)
+        {
+            std::lock_guard lock(mutex);
+            timelines.push_back(timeline);
+        }
+
+        void Push(std::function<void()> destroy)
+        {
+            std::lock_guard lock(mutex);
+            entries.push_back({Values(true), std::move(destroy)});
+        }
+
+        // Runs every entry whose timeline values are reached. Entries are pushed with non decreasing values, so the
+        // scan stops at the first one still pending. Callbacks run outside the lock and may push again.
+        size_t Collect()
+        {
+            std::vector<std::function<void()>> ready;
+            {
+                std::lock_guard lock(mutex);
+                if (entries.empty())
+                    return 0;
+                auto completed = Values(false);
+                while (!entries.empty() && Reached(entries.front().values, completed))
+                {
+                    ready.push_back(std::move(entries.front().destroy));
+                    entries.pop_front();
+                }
+            }
+            for (auto& destroy : ready)
+            {
+                destroy();
+            }
+            return ready.size();
+        }
+
+        // Only for device teardown, after waitIdle. Runs everything including what the callbacks push.
+        void Flush()
+        {
+            while (true)
+            {
+                std::deque<Entry> pending;
+                {
+                    std::lock_guard lock(mutex);
+                    pending.swap(entries);
+                }
+                if (pending.empty())
+                    break;
+                for (auto& entry : pending)
+                {
+                    entry.destroy();
+                }
+            }
+        }
+
+        size_t Size()
+        {
+            std::lock_guard lock(mutex);
+            return entries.size();
+        }
+    };
+
+    using DeletionQueue = DeletionQueueBase<Timeline>;
+};
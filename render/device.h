@@ -1,7 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+
 #include "../log/log.h"
 #include "instance.h"
+#include "cache.h"
+#include "shader.h"
+#include "layout.h"
+#include "library.h"
+#include "allocator.h"
+#include "deletion.h"
+#include "state.h"
 #include "vulkan/vulkan.hpp"
 
 
@@ -13,16 +24,45 @@ namespace inner
         private:
         std::shared_ptr<Instance> instance;
         vk::PhysicalDevice _physical;
+        std::vector<std::string> extensions;
+        vk::DispatchLoaderDynamic dispatch;
+        bool extended_dynamic_state = false;
+        bool extended_dynamic_state2 = false;
+        bool graphics_pipeline_library = false;
+        vk::PhysicalDeviceFeatures features;
+        bool draw_indirect_count = false;
+        std::unique_ptr<PipelineCache> pipeline_cache;
+        std::unique_ptr<PipelineLibraryCache> library_cache;
+        std::unique_ptr<MemoryAllocator> allocator;
+        std::unique_ptr<ShaderCache> shader_cache;
+        std::unique_ptr<LayoutCache> layout_cache;
+        PipelineRegistry pipeline_registry;
+        DeletionQueue deletion_queue;
 
         public:
 
-        Device(vk::Device device, vk::PhysicalDevice physical, std::shared_ptr<inner::Instance> instance):
-        vk::Device(device), _physical(physical), instance(instance)
-        {}
+        Device(vk::Device device, vk::PhysicalDevice physical, std::shared_ptr<inner::Instance> instance, std::vector<const char*> enabled, std::filesystem::path cache_path, size_t shader_cache_size, vk::DeviceSize block_size, bool extended_dynamic_state, bool extended_dynamic_state2, bool graphics_pipeline_library, vk::PhysicalDeviceFeatures features, bool draw_indirect_count):
+        vk::Device(device), _physical(physical), instance(instance), extensions(enabled.begin(), enabled.end()),
+        extended_dynamic_state(extended_dynamic_state), extended_dynamic_state2(extended_dynamic_state2), graphics_pipeline_library(graphics_pipeline_library),
+        features(features), draw_indirect_count(draw_indirect_count)
+        {
+            dispatch.init(static_cast<VkInstance>(*instance), vkGetInstanceProcAddr, static_cast<VkDevice>(device), vkGetDeviceProcAddr);
+            pipeline_cache = std::make_unique<PipelineCache>(device, physical, cache_path, HasExtension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME));
+            shader_cache = std::make_unique<ShaderCache>(device, shader_cache_size);
+            layout_cache = std::make_unique<LayoutCache>(device);
+            library_cache = std::make_unique<PipelineLibraryCache>(device);
+            allocator = std::make_unique<MemoryAllocator>(device, physical, block_size);
+        }
 
         ~Device()
         {
             waitIdle();
+            deletion_queue.Flush();
+            library_cache.reset();
+            layout_cache.reset();
+            shader_cache.reset();
+            pipeline_cache.reset();
+            allocator.reset();
             destroy();
         }
 
@@ -31,6 +71,93 @@ namespace inner
             return _physical;
         }
 
+        bool HasExtension(const std::string& name)
+        {
+            return std::find(extensions.begin(), extensions.end(), name) != extensions.end();
+        }
+
+        // Entry points of enabled device extensions, the static loader only exports core functions.
+        const vk::DispatchLoaderDynamic& Dispatch()
+        {
+            return dispatch;
+        }
+
+        // True when the extension and its feature were both enabled at creation.
+        auto HasExtendedDynamicState()
+        {
+            return extended_dynamic_state;
+        }
+
+        auto HasExtendedDynamicState2()
+        {
+            return extended_dynamic_state2;
+        }
+
+        // VK_EXT_graphics_pipeline_library, only ever true when built against headers that know the extension.
+        auto HasGraphicsPipelineLibrary()
+        {
+            return graphics_pipeline_library;
+        }
+
+        // The core features DeviceBuilder::SetEnabledFeatures asked for, all of them are enabled on this device.
+        const vk::PhysicalDeviceFeatures& Features()
+        {
+            return features;
+        }
+
+        // Vulkan 1.2 drawIndirectCount, enabled whenever the device supports it.
+        auto HasDrawIndirectCount()
+        {
+            return draw_indirect_count;
+        }
+
+        PipelineCache& GetPipelineCache()
+        {
+            return *pipeline_cache;
+        }
+
+        ShaderCache& GetShaderCache()
+        {
+            return *shader_cache;
+        }
+
+        MemoryAllocator& GetAllocator()
+        {
+            return *allocator;
+        }
+
+        PipelineLibraryCache& GetLibraryCache()
+        {
+            return *library_cache;
+        }
+
+        LayoutCache& GetLayoutCache()
+        {
+            return *layout_cache;
+        }
+
+        PipelineRegistry& GetPipelineRegistry()
+        {
+            return pipeline_registry;
+        }
+
+        // For objects the GPU may still be using, covers every queue DeviceBuilder created.
+        DeletionQueue& GetDeletionQueue()
+        {
+            return deletion_queue;
+        }
+
+        // Destroys the handles once all work submitted so far has finished. Wrappers call this from their destructors
+        // instead of destroying right away, so dropping a resource never needs a waitIdle.
+        template <typename... T>
+        void Retire(T... handles)
+        {
+            vk::Device device = *this;
+            deletion_queue.Push([device, handles...]() {
+                (device.destroy(handles), ...);
+            });
+        }
+
     };
 };
 
@@ -43,18 +170,114 @@ enum QueueType
     TRANSFER,
 };
 
+namespace inner
+{
+    // Timeline semaphore signalled by every submission to one vk::Queue. Values are handed out under a lock together
+    // with the submit itself, so they reach the queue in increasing order even with several submitting threads.
+    class Timeline
+    {
+        private:
+        std::shared_ptr<Device> device;
+        vk::Semaphore semaphore;
+        uint64_t last = 0;
+        std::mutex mutex;
+        public:
+        Timeline(std::shared_ptr<Device> device):
+        device(device)
+        {
+            auto type = vk::SemaphoreTypeCreateInfo()
+                .setSemaphoreType(vk::SemaphoreType::eTimeline)
+                .setInitialValue(0);
+            semaphore = device->createSemaphore(vk::SemaphoreCreateInfo().setPNext(&type));
+        }
+
+        ~Timeline()
+        {
+            device->destroySemaphore(semaphore);
+        }
+
+        auto Semaphore()
+        {
+            return semaphore;
+        }
+
+        // submit(semaphore, value) has to signal semaphore to value, the value is only consumed if it does not throw.
+        template <typename F>
+        uint64_t Submit(F&& submit)
+        {
+            std::lock_guard lock(mutex);
+            submit(semaphore, last + 1);
+            return ++last;
+        }
+
+        uint64_t Last()
+        {
+            std::lock_guard lock(mutex);
+            return last;
+        }
+
+        // Runs other calls on the queue, such as presents and waitIdle, under the submit lock. A vk::Queue shared by
+        // several Queue objects is then never used by two threads at once.
+        template <typename F>
+        auto Exclusive(F&& call)
+        {
+            std::lock_guard lock(mutex);
+            return call();
+        }
+
+        uint64_t Completed()
+        {
+            return device->getSemaphoreCounterValue(semaphore);
+        }
+
+        void Wait(uint64_t value, uint64_t timeout = UINT64_MAX)
+        {
+            auto result = device->waitSemaphores(
+                vk::SemaphoreWaitInfo()
+                    .setSemaphores(semaphore)
+                    .setValues(value),
+                timeout);
+            if (result != vk::Result::eSuccess && result != vk::Result::eTimeout)
+            {
+                throw(std::exception("Waiting on a timeline semaphore failed"));
+            }
+        }
+    };
+};
+
+// A point on a queue's timeline, reached once all work submitted up to it has finished.
+struct SyncToken
+{
+    public:
+    std::shared_ptr<inner::Timeline> timeline;
+    uint64_t value = 0;
+
+    bool Ready() const
+    {
+        return !timeline || timeline->Completed() >= value;
+    }
+
+    void Wait() const
+    {
+        if (timeline)
+            timeline->Wait(value);
+    }
+};
+
 class Queue : public vk::Queue
 {
     private:
     uint32_t family;
     Device device;
+    std::shared_ptr<inner::Timeline> timeline;
     public:
     Queue() 
     {}
-    Queue(vk::Queue queue, Device device, uint32_t family):
+    Queue(vk::Queue queue, Device device, uint32_t family, std::shared_ptr<inner::Timeline> timeline):
     vk::Queue(queue),
     family(family),
-    device(device)
+    device(device),
+    timeline(timeline)
     {}
 
     auto Family()
@@ -67,6 +290,22 @@ class Queue : public vk::Queue
         return device;
     }
 
+    // Shared by every Queue object that ended up on the same vk::Queue.
+    auto Timeline()
+    {
+        return timeline;
+    }
+
+    auto Present(const vk::PresentInfoKHR& info)
+    {
+        return timeline->Exclusive([&] { return presentKHR(info); });
+    }
+
+    void WaitIdle()
+    {
+        timeline->Exclusive([&] { waitIdle(); });
+    }
+
 };
 
 
@@ -349,35 +588,74 @@ private:
         return 0;
     }
 
+    // Prefers a family without graphics so compute work runs beside rendering, otherwise shares a graphics family.
     auto FindComputeQueue(vk::PhysicalDevice physical_device)
     {
-        for (auto index = 0; index < physical_device.getQueueFamilyProperties().size(); index++)
+        auto families = physical_device.getQueueFamilyProperties();
+        for (auto index = 0; index < families.size(); index++)
         {
-            auto family = physical_device.getQueueFamilyProperties()[index];
-            if (family.queueFlags == vk::QueueFlagBits::eCompute)
+            if ((families[index].queueFlags & vk::QueueFlagBits::eCompute) && !(families[index].queueFlags & vk::QueueFlagBits::eGraphics))
+            {
+                return index;
+            }
+        }
+        for (auto index = 0; index < families.size(); index++)
+        {
+            if (families[index].queueFlags & vk::QueueFlagBits::eCompute)
             {
                 return index;
             }
         }
-        throw(std::exception("Unable to find a dedicated compute family"));
+        throw(std::exception("Unable to find a compute family"));
         return 0;
     }
 
+    // Prefers a copy engine family, then anything without graphics, then any family since graphics and compute imply transfer.
     auto FindTransferQueue(vk::PhysicalDevice physical_device)
     {
-        for (auto index = 0; index < physical_device.getQueueFamilyProperties().size(); index++)
+        auto families = physical_device.getQueueFamilyProperties();
+        for (auto index = 0; index < families.size(); index++)
         {
-            auto family = physical_device.getQueueFamilyProperties()[index];
-            if (family.queueFlags == vk::QueueFlagBits::eTransfer)
+            if ((families[index].queueFlags & vk::QueueFlagBits::eTransfer) && !(families[index].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
             {
                 return index;
             }
         }
-        throw(std::exception("Unable to find a dedicated transfer family"));
+        for (auto index = 0; index < families.size(); index++)
+        {
+            if (!(families[index].queueFlags & vk::QueueFlagBits::eGraphics) && (families[index].queueFlags & (vk::QueueFlagBits::eTransfer | vk::QueueFlagBits::eCompute)))
+            {
+                return index;
+            }
+        }
+        for (auto index = 0; index < families.size(); index++)
+        {
+            if (families[index].queueFlags & (vk::QueueFlagBits::eTransfer | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics))
+            {
+                return index;
+            }
+        }
+        throw(std::exception("Unable to find a transfer family"));
         return 0;
     }
 
+    auto SupportsExtension(vk::PhysicalDevice physical_device, const char* name)
+    {
+        for (auto& p : physical_device.enumerateDeviceExtensionProperties())
+        {
+            if (strcmp(p.extensionName, name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     vk::PhysicalDeviceFeatures m_Features;
+    std::filesystem::path m_PipelineCache;
+    size_t m_ShaderCacheSize = 64;
+    bool m_ExtendedDynamicState = false;
+    vk::DeviceSize m_BlockSize = 64 * 1024 * 1024;
 public:
     auto SetEnabledFeatures(vk::PhysicalDeviceFeatures features)
     {
@@ -385,14 +663,45 @@ public:
         return *this;
     }
 
+    // Pipeline cache blob loaded at Build and written back when the device is destroyed, leave empty to keep it in memory only.
+    auto SetPipelineCache(std::filesystem::path path)
+    {
+        m_PipelineCache = path;
+        return *this;
+    }
+
+    // Number of recently used shader modules kept alive after no builder references them anymore.
+    auto SetShaderCacheSize(size_t modules)
+    {
+        m_ShaderCacheSize = modules;
+        return *this;
+    }
+
+    // Size of the vk::DeviceMemory blocks buffers and images are sub-allocated from.
+    auto SetMemoryBlockSize(vk::DeviceSize bytes)
+    {
+        m_BlockSize = bytes;
+        return *this;
+    }
+
+    // Enables VK_EXT_extended_dynamic_state and VK_EXT_extended_dynamic_state2 where the device supports them.
+    // Pipelines built with SetDynamicState work either way, without the extensions they fall back to permutations.
+    auto SetExtendedDynamicState(bool enable = true)
+    {
+        m_ExtendedDynamicState = enable;
+        return *this;
+    }
+
     auto Build(Instance instance, Surface surface, std::vector<QueueType> queues)
     {
         auto physical_device = FindPhysicalDevice(*instance);
-        float priority = 1.0f;
+        auto properties = physical_device.getQueueFamilyProperties();
         std::vector<vk::DeviceQueueCreateInfo> queue_infos;
 
+        // Each requested queue gets its own vk::Queue while the family has enough, after that they share the last one.
         int family;
-        std::vector<int> families;
+        std::vector<std::pair<int, uint32_t>> families;
+        std::map<int, uint32_t> family_counts;
         for (auto& queue : queues) 
         {
             switch(queue)
@@ -407,33 +716,93 @@ public:
                     family = FindTransferQueue(physical_device);
                     break;
             }
-            families.push_back(family);
+            auto& count = family_counts[family];
+            families.emplace_back(family, std::min(count, properties[family].queueCount - 1));
+            count = std::min(count + 1, properties[family].queueCount);
+        }
+        std::vector<float> priorities(queues.size(), 1.0f);
+        for (auto [index, count] : family_counts)
+        {
             queue_infos.emplace_back(
                 vk::DeviceQueueCreateInfo()
-                .setQueueFamilyIndex(family)
-                .setQueueCount(1)
-                .setPQueuePriorities(&priority)
+                .setQueueFamilyIndex(index)
+                .setQueueCount(count)
+                .setPQueuePriorities(priorities.data())
             );
         }
 
         std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        if (SupportsExtension(physical_device, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME))
+        {
+            deviceExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+        }
+
         auto i = vk::DeviceCreateInfo()
             .setQueueCreateInfos(queue_infos)
-            .setPEnabledExtensionNames(deviceExtensions)
             .setPEnabledFeatures(&m_Features);
 
+        auto supported = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT, vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT>();
+        if (!supported.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore)
+        {
+            throw(std::exception("Device does not support timeline semaphores"));
+        }
+        auto vulkan12 = vk::PhysicalDeviceVulkan12Features()
+            .setTimelineSemaphore(true)
+            .setDrawIndirectCount(supported.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount);
+        i.setPNext(&vulkan12);
+
+        auto extended = vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT();
+        auto extended2 = vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT();
+        if (m_ExtendedDynamicState && SupportsExtension(physical_device, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)
+            && supported.get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>().extendedDynamicState)
+        {
+            deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+            extended.setExtendedDynamicState(true).setPNext(const_cast<void*>(i.pNext));
+            i.setPNext(&extended);
+        }
+        if (m_ExtendedDynamicState && SupportsExtension(physical_device, VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)
+            && supported.get<vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT>().extendedDynamicState2)
+        {
+            deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+            extended2.setExtendedDynamicState2(true).setPNext(const_cast<void*>(i.pNext));
+            i.setPNext(&extended2);
+        }
+        bool library = false;
+#ifdef VK_EXT_graphics_pipeline_library
+        auto library_supported = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+        auto library_features = vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT();
+        if (SupportsExtension(physical_device, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) && SupportsExtension(physical_device, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)
+            && library_supported.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary)
+        {
+            deviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+            library_features.setGraphicsPipelineLibrary(true).setPNext(const_cast<void*>(i.pNext));
+            i.setPNext(&library_features);
+            library = true;
+        }
+#endif
+        i.setPEnabledExtensionNames(deviceExtensions);
+
         auto device = physical_device.createDevice(i);
         if(!device)
         {
             throw(std::exception("Could not create device"));
         }
 
-        auto r_device = std::make_shared<inner::Device>(device, physical_device, instance);
+        auto r_device = std::make_shared<inner::Device>(device, physical_device, instance, deviceExtensions, m_PipelineCache, m_ShaderCacheSize, m_BlockSize,
+            extended.extendedDynamicState == VK_TRUE, extended2.extendedDynamicState2 == VK_TRUE, library, m_Features, vulkan12.drawIndirectCount == VK_TRUE);
 
+        std::map<std::pair<int, uint32_t>, std::shared_ptr<inner::Timeline>> timelines;
         std::vector<Queue> d_queues;
-        for (auto family : families) {
+        for (auto queue : families) {
+            auto& timeline = timelines[queue];
+            if (!timeline)
+            {
+                timeline = std::make_shared<inner::Timeline>(r_device);
+                r_device->GetDeletionQueue().Register(timeline);
+            }
             d_queues.emplace_back(
-                Queue(r_device->getQueue(family, 0) ,r_device, family)
+                Queue(r_device->getQueue(queue.first, queue.second), r_device, queue.first, timeline)
             );
         }
 
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "pool.h"
+
+// One draw as recorded into a DrawStream. Plain data, the stream never owns anything it points to.
+struct DrawPacket
+{
+    public:
+    inner::Pipeline* pipeline = nullptr;
+    vk::DescriptorSet set;
+    uint32_t set_index = 0;
+    vk::Buffer vertex;
+    vk::DeviceSize vertex_offset = 0;
+    vk::Buffer index;
+    vk::DeviceSize index_offset = 0;
+    vk::IndexType index_type = vk::IndexType::eUint32;
+    // Index count when index is set, vertex count otherwise.
+    uint32_t count = 0;
+    uint32_t instances = 1;
+    uint32_t first = 0;
+    int32_t base_vertex = 0;
+    uint32_t first_instance = 0;
+};
+
+// Builds the 64 bit sort key, most significant first: pass (4 bits), pipeline (20), descriptor set (20), depth (20).
+// pipeline and set are small ids chosen by the caller, a PipelineHandle's index works. Sorting ascending groups
+// draws by pass, then by state, and within equal state front to back.
+struct DrawKey
+{
+    public:
+    static uint64_t Make(uint32_t pass, uint32_t pipeline, uint32_t set, uint32_t depth)
+    {
+        return (uint64_t(pass & 0xF) << 60) | (uint64_t(pipeline & 0xFFFFF) << 40) | (uint64_t(set & 0xFFFFF) << 20) | uint64_t(depth & 0xFFFFF);
+    }
+
+    // Maps a depth in [0, 1] to 20 bits, pass 1 - depth for back to front ordering of transparent draws.
+    static uint32_t Depth(float depth)
+    {
+        depth = std::min(std::max(depth, 0.0f), 1.0f);
+        return static_cast<uint32_t>(depth * 0xFFFFF);
+    }
+};
+
+struct DrawStreamStats
+{
+    public:
+    uint32_t draws = 0;
+    uint32_t pipeline_binds = 0;
+    uint32_t set_binds = 0;
+    uint32_t vertex_binds = 0;
+    uint32_t index_binds = 0;
+};
+
+// Collects draws for a frame, sorts them by key and replays them with redundant binds left out. Clear keeps the
+// storage, so after the first few frames pushing, sorting and replaying do not allocate.
+class DrawStream
+{
+    private:
+    std::vector<DrawPacket> m_Packets;
+    std::vector<uint64_t> m_Keys;
+    std::vector<uint32_t> m_Order;
+    // Sort works on a copy, m_Keys stays in push order alongside m_Packets.
+    std::vector<uint64_t> m_SortedKeys;
+    std::vector<uint64_t> m_KeysScratch;
+    std::vector<uint32_t> m_OrderScratch;
+    DrawStreamStats m_Stats;
+    public:
+    void Clear()
+    {
+        m_Packets.clear();
+        m_Keys.clear();
+        m_Order.clear();
+    }
+
+    void Push(uint64_t key, const DrawPacket& packet)
+    {
+        m_Keys.push_back(key);
+        m_Packets.push_back(packet);
+    }
+
+    // LSD radix sort over the keys, 8 bits per pass. Passes where every key has the same byte are skipped, which
+    // with the usual few pipelines and sets leaves about half of them. Stable, so equal keys keep push order.
+    void Sort()
+    {
+        auto count = m_Keys.size();
+        m_SortedKeys.assign(m_Keys.begin(), m_Keys.end());
+        m_Order.resize(count);
+        m_OrderScratch.resize(count);
+        m_KeysScratch.resize(count);
+        for (uint32_t x = 0; x < count; x++)
+        {
+            m_Order[x] = x;
+        }
+
+        std::array<std::array<uint32_t, 256>, 8> histograms = {};
+        for (auto key : m_Keys)
+        {
+            for (uint32_t pass = 0; pass < 8; pass++)
+            {
+                histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+            }
+        }
+
+        for (uint32_t pass = 0; pass < 8; pass++)
+        {
+            auto& histogram = histograms[pass];
+            auto shift = pass * 8;
+            if (count == 0 || histogram[(m_SortedKeys[0] >> shift) & 0xFF] == count)
+                continue;
+
+            uint32_t offset = 0;
+            for (auto& bucket : histogram)
+            {
+                auto size = bucket;
+                bucket = offset;
+                offset += size;
+            }
+            for (size_t x = 0; x < count; x++)
+            {
+                auto target = histogram[(m_SortedKeys[x] >> shift) & 0xFF]++;
+                m_KeysScratch[target] = m_SortedKeys[x];
+                m_OrderScratch[target] = m_Order[x];
+            }
+            m_SortedKeys.swap(m_KeysScratch);
+            m_Order.swap(m_OrderScratch);
+        }
+    }
+
+    // Records the packets in sorted order, Sort has to have been called since the last Push.
+    void Replay(inner::CommandBuffer& buffer)
+    {
+        m_Stats = {};
+        inner::Pipeline* pipeline = nullptr;
+        vk::DescriptorSet set;
+        vk::Buffer vertex, index;
+        vk::DeviceSize vertex_offset = 0, index_offset = 0;
+        auto index_type = vk::IndexType::eUint32;
+        for (auto x : m_Order)
+        {
+            auto& packet = m_Packets[x];
+            if (packet.pipeline != pipeline)
+            {
+                pipeline = packet.pipeline;
+                buffer.bindPipeline(*pipeline);
+                // A new layout may disturb set bindings, bind the set again rather than tracking compatibility.
+                set = nullptr;
+                m_Stats.pipeline_binds++;
+            }
+            if (packet.set && packet.set != set)
+            {
+                set = packet.set;
+                buffer.bindDescriptorSets(pipeline->bind(), pipeline->Layout(), packet.set_index, set, {});
+                m_Stats.set_binds++;
+            }
+            if (packet.vertex && (packet.vertex != vertex || packet.vertex_offset != vertex_offset))
+            {
+                vertex = packet.vertex;
+                vertex_offset = packet.vertex_offset;
+                buffer.bindVertexBuffers(0, vertex, vertex_offset);
+                m_Stats.vertex_binds++;
+            }
+            if (packet.index)
+            {
+                if (packet.index != index || packet.index_offset != index_offset || packet.index_type != index_type)
+                {
+                    index = packet.index;
+                    index_offset = packet.index_offset;
+                    index_type = packet.index_type;
+                    buffer.bindIndexBuffer(index, index_offset, packet.index_type);
+                    m_Stats.index_binds++;
+                }
+                buffer.drawIndexed(packet.count, packet.instances, packet.first, packet.base_vertex, packet.first_instance);
+            }
+            else
+            {
+                buffer.draw(packet.count, packet.instances, packet.first, packet.first_instance);
+            }
+            m_Stats.draws++;
+        }
+    }
+
+    size_t Size()
+    {
+        return m_Packets.size();
+    }
+
+    // Counts of the last Replay.
+    auto GetStats()
+    {
+        return m_Stats;
+    }
+};
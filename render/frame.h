@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstring>
+
+#include "memory.h"
+
+// Transient memory handed out by FrameAllocator, valid until the frame that allocated it comes around again.
+struct FrameAllocation
+{
+    public:
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    uint8_t* mapped = nullptr;
+
+    // For a descriptor bound with eUniformBufferDynamic, the offset goes to bindDescriptorSets instead.
+    auto Info()
+    {
+        return vk::DescriptorBufferInfo(buffer, offset, size);
+    }
+};
+
+namespace inner
+{
+    // Bump allocator over persistently mapped buffers with one partition per frame in flight. Begin(frame) rewinds
+    // that frame's partition, which the caller may only do once the GPU finished the frame that last used it.
+    // A frame that runs out of space chains another block, blocks are kept so later frames do not allocate at all.
+    class FrameAllocator
+    {
+        private:
+        struct Partition
+        {
+            std::vector<std::shared_ptr<Buffer>> blocks;
+            size_t block = 0;
+            vk::DeviceSize offset = 0;
+        };
+
+        std::shared_ptr<Device> device;
+        std::vector<Partition> partitions;
+        Partition* current = nullptr;
+        vk::DeviceSize block_size;
+        vk::DeviceSize uniform_alignment;
+        vk::BufferUsageFlags usage;
+
+        std::shared_ptr<Buffer> CreateBlock(vk::DeviceSize size)
+        {
+            return BufferBuilder()
+                .SetSize(size)
+                .SetUsage(usage)
+                .SetMemoryUsage(MemoryUsage::CPU_TO_GPU)
+                .Build(device);
+        }
+
+        public:
+        FrameAllocator(std::shared_ptr<Device> device, uint32_t frames, vk::DeviceSize block_size, vk::BufferUsageFlags usage):
+        device(device), partitions(frames), block_size(block_size), usage(usage)
+        {
+            uniform_alignment = device->physical().getProperties().limits.minUniformBufferOffsetAlignment;
+            for (auto& partition : partitions)
+            {
+                partition.blocks.push_back(CreateBlock(block_size));
+            }
+            current = &partitions.front();
+        }
+
+        void Begin(uint32_t frame)
+        {
+            current = &partitions.at(frame % partitions.size());
+            current->block = 0;
+            current->offset = 0;
+        }
+
+        // alignment 0 uses minUniformBufferOffsetAlignment, so the offset can be used as a dynamic uniform offset.
+        FrameAllocation Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 0)
+        {
+            alignment = std::max<vk::DeviceSize>(alignment ? alignment : uniform_alignment, 1);
+            auto& partition = *current;
+            auto offset = (partition.offset + alignment - 1) / alignment * alignment;
+            while (offset + size > partition.blocks[partition.block]->Size())
+            {
+                partition.block++;
+                if (partition.block == partition.blocks.size())
+                {
+                    partition.blocks.push_back(CreateBlock(std::max(block_size, size)));
+                }
+                offset = 0;
+            }
+            partition.offset = offset + size;
+
+            auto& block = partition.blocks[partition.block];
+            return FrameAllocation{*block, offset, size, block->Mapped() + offset};
+        }
+
+        template <typename T>
+        FrameAllocation Push(const T& value, vk::DeviceSize alignment = 0) requires std::is_trivially_copyable_v<T>
+        {
+            auto allocation = Allocate(sizeof(T), alignment);
+            std::memcpy(allocation.mapped, &value, sizeof(T));
+            return allocation;
+        }
+
+        template <typename T>
+        FrameAllocation Push(const std::vector<T>& values, vk::DeviceSize alignment = 0) requires std::is_trivially_copyable_v<T>
+        {
+            auto allocation = Allocate(sizeof(T) * values.size(), alignment);
+            std::memcpy(allocation.mapped, values.data(), sizeof(T) * values.size());
+            return allocation;
+        }
+    };
+};
+
+using FrameAllocator = std::shared_ptr<inner::FrameAllocator>;
+
+class FrameAllocatorBuilder
+{
+    private:
+    vk::DeviceSize m_BlockSize = 4 * 1024 * 1024;
+    vk::BufferUsageFlags m_Usage = vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+    public:
+    auto SetBlockSize(vk::DeviceSize bytes)
+    {
+        m_BlockSize = bytes;
+        return *this;
+    }
+
+    auto SetUsage(vk::BufferUsageFlags usage)
+    {
+        m_Usage = usage;
+        return *this;
+    }
+
+    // frames is the number of frames that can be in flight, each gets its own partition.
+    auto Build(Device device, uint32_t frames)
+    {
+        return std::make_shared<inner::FrameAllocator>(device, frames, m_BlockSize, m_Usage);
+    }
+};
@@ -0,0 +1,823 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "pool.h"
+#include "memory.h"
+#include "passcache.h"
+
+// How a pass uses an image. Decides the layout the image is in during the pass, what barriers wait on and what
+// transient images are created for.
+enum class GraphAccess
+{
+    // Color attachment, loaded when an earlier pass wrote it and not cleared.
+    COLOR,
+    // Depth attachment, read and written by the depth test.
+    DEPTH,
+    // Sampled from the pass's shaders, fragment for passes with attachments and compute otherwise.
+    SAMPLED,
+    STORAGE_READ,
+    STORAGE_WRITE,
+    TRANSFER_SRC,
+    TRANSFER_DST,
+};
+
+struct GraphImageInfo
+{
+    public:
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    // A zero extent follows the extent passed to Compile.
+    vk::Extent2D extent = vk::Extent2D(0, 0);
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+};
+
+struct GraphStats
+{
+    public:
+    uint32_t passes = 0;
+    uint32_t culled = 0;
+    // vkCmdPipelineBarrier calls and image barriers in them per Execute.
+    uint32_t barriers = 0;
+    uint32_t image_barriers = 0;
+    // What the transient images need on their own versus what was allocated for them with aliasing.
+    vk::DeviceSize transient_bytes = 0;
+    vk::DeviceSize allocated_bytes = 0;
+
+    vk::DeviceSize Saved() const
+    {
+        return transient_bytes - allocated_bytes;
+    }
+};
+
+namespace inner
+{
+    class RenderGraph;
+};
+
+// A pass as declared to the graph. Uses are declared by resource name, each resource at most once per pass, and
+// decide ordering, culling and barriers. Passes with a COLOR or DEPTH use get a render pass begun around Execute.
+class GraphPass
+{
+    friend class inner::RenderGraph;
+    private:
+    struct Use
+    {
+        std::string resource;
+        GraphAccess access;
+        bool write;
+    };
+
+    std::string name;
+    std::vector<Use> uses;
+    std::unordered_map<std::string, vk::ClearValue> clears;
+    std::function<void(inner::CommandBuffer&)> execute;
+    bool side_effects = false;
+
+    auto& Add(const std::string& resource, GraphAccess access, bool write)
+    {
+        for (auto& use : uses)
+        {
+            if (use.resource == resource)
+                throw(std::exception("A pass can only use a resource once"));
+        }
+        uses.push_back(Use{resource, access, write});
+        return *this;
+    }
+    public:
+    GraphPass(const std::string& name):
+    name(name)
+    {}
+
+    GraphPass& Read(const std::string& resource, GraphAccess access = GraphAccess::SAMPLED)
+    {
+        return Add(resource, access, false);
+    }
+
+    // COLOR, DEPTH, STORAGE_WRITE and TRANSFER_DST, the only accesses that write.
+    GraphPass& Write(const std::string& resource, GraphAccess access = GraphAccess::COLOR)
+    {
+        return Add(resource, access, true);
+    }
+
+    // Clears an attachment when the render pass begins, earlier writes to it are then dead.
+    GraphPass& Clear(const std::string& resource, vk::ClearValue value)
+    {
+        clears[resource] = value;
+        return *this;
+    }
+
+    // Keeps the pass even when nothing live reads what it writes, e.g. for readbacks.
+    GraphPass& SetSideEffects()
+    {
+        side_effects = true;
+        return *this;
+    }
+
+    // Records the pass. Inside the render pass for passes with attachments, viewport and scissor already set.
+    GraphPass& SetExecute(std::function<void(inner::CommandBuffer&)> fn)
+    {
+        execute = fn;
+        return *this;
+    }
+};
+
+namespace inner
+{
+    // Frame level render graph. Passes are declared in submission order with the images they read and write, Compile
+    // culls passes nothing live depends on, creates the transient images, aliasing the memory of those whose
+    // lifetimes do not overlap, and works out the barriers between passes once. Execute then only replays them, with
+    // each barrier waiting on exactly the stages of the previous use and transitioning straight to the next layout.
+    // Passes are not merged into subpasses, every pass with attachments gets its own render pass.
+    class RenderGraph
+    {
+        private:
+        struct AccessInfo
+        {
+            vk::PipelineStageFlags stages;
+            vk::AccessFlags access;
+            vk::ImageLayout layout;
+            vk::ImageUsageFlags usage;
+        };
+
+        struct Resource
+        {
+            std::string name;
+            GraphImageInfo info;
+            bool imported = false;
+            vk::Image image;
+            vk::ImageView view;
+            vk::ImageLayout initial = vk::ImageLayout::eUndefined;
+            vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
+            vk::PipelineStageFlags import_stages;
+            vk::AccessFlags import_access;
+            // Live pass range, for aliasing.
+            uint32_t first = UINT32_MAX;
+            uint32_t last = 0;
+            vk::ImageUsageFlags usage;
+            vk::MemoryRequirements requirements;
+            uint32_t slot = UINT32_MAX;
+            // What the next user of the memory has to wait on once the frame's passes are done with it.
+            vk::PipelineStageFlags end_stages;
+            vk::AccessFlags end_access;
+        };
+
+        struct Batch
+        {
+            vk::PipelineStageFlags src;
+            vk::PipelineStageFlags dst;
+            std::vector<vk::ImageMemoryBarrier> barriers;
+            std::vector<uint32_t> resources;
+        };
+
+        struct Compiled
+        {
+            uint32_t pass;
+            Batch batch;
+            std::shared_ptr<Renderpass> renderpass;
+            std::vector<uint32_t> attachments;
+            std::vector<vk::ClearValue> clears;
+        };
+
+        struct Slot
+        {
+            vk::MemoryRequirements requirements;
+            std::vector<uint32_t> resources;
+        };
+
+        std::shared_ptr<Device> device;
+        std::shared_ptr<RenderpassCache> renderpasses;
+        std::shared_ptr<FramebufferCache> framebuffers;
+        std::deque<GraphPass> passes;
+        std::vector<Resource> resources;
+        std::unordered_map<std::string, uint32_t> names;
+        std::vector<Compiled> compiled;
+        Batch end;
+        std::vector<Slot> slots;
+        std::vector<Allocation> memory;
+        vk::Extent2D extent;
+        GraphStats stats;
+        bool aliasing;
+
+        static bool IsDepth(vk::Format format)
+        {
+            switch (format)
+            {
+                case vk::Format::eD16Unorm:
+                case vk::Format::eD16UnormS8Uint:
+                case vk::Format::eD24UnormS8Uint:
+                case vk::Format::eD32Sfloat:
+                case vk::Format::eD32SfloatS8Uint:
+                return true;
+                default:
+                return false;
+            }
+        }
+
+        static vk::ImageAspectFlags Aspect(vk::Format format)
+        {
+            switch (format)
+            {
+                case vk::Format::eD16UnormS8Uint:
+                case vk::Format::eD24UnormS8Uint:
+                case vk::Format::eD32SfloatS8Uint:
+                return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+                default:
+                return IsDepth(format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+            }
+        }
+
+        static AccessInfo Info(GraphAccess access, bool graphics)
+        {
+            auto shader = graphics ? vk::PipelineStageFlagBits::eFragmentShader : vk::PipelineStageFlagBits::eComputeShader;
+            switch (access)
+            {
+                case GraphAccess::COLOR:
+                return {vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                    vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+                    vk::ImageLayout::eColorAttachmentOptimal, vk::ImageUsageFlagBits::eColorAttachment};
+                case GraphAccess::DEPTH:
+                return {vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+                    vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment};
+                case GraphAccess::SAMPLED:
+                return {shader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled};
+                case GraphAccess::STORAGE_READ:
+                return {shader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral, vk::ImageUsageFlagBits::eStorage};
+                case GraphAccess::STORAGE_WRITE:
+                return {shader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral, vk::ImageUsageFlagBits::eStorage};
+                case GraphAccess::TRANSFER_SRC:
+                return {vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead, vk::ImageLayout::eTransferSrcOptimal, vk::ImageUsageFlagBits::eTransferSrc};
+                default:
+                return {vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eTransferDstOptimal, vk::ImageUsageFlagBits::eTransferDst};
+            }
+        }
+
+        static vk::AccessFlags Writes(vk::AccessFlags access)
+        {
+            return access & (vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite
+                | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite);
+        }
+
+        static bool IsGraphics(const GraphPass& pass)
+        {
+            return std::any_of(pass.uses.begin(), pass.uses.end(), [](auto& use) {
+                return use.access == GraphAccess::COLOR || use.access == GraphAccess::DEPTH;
+            });
+        }
+
+        vk::Extent2D Size(const Resource& r)
+        {
+            return r.info.extent.width ? r.info.extent : extent;
+        }
+
+        uint32_t Find(const std::string& name)
+        {
+            auto found = names.find(name);
+            if (found == names.end())
+                throw(std::exception(("Unknown render graph resource: " + name).c_str()));
+            return found->second;
+        }
+
+        void Add(Batch& batch, uint32_t resource, vk::PipelineStageFlags src, vk::AccessFlags src_access,
+            vk::PipelineStageFlags dst, vk::AccessFlags dst_access, vk::ImageLayout from, vk::ImageLayout to)
+        {
+            auto& r = resources[resource];
+            batch.src |= src;
+            batch.dst |= dst;
+            batch.resources.push_back(resource);
+            batch.barriers.push_back(
+                vk::ImageMemoryBarrier()
+                    .setSrcAccessMask(src_access)
+                    .setDstAccessMask(dst_access)
+                    .setOldLayout(from)
+                    .setNewLayout(to)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setSubresourceRange(vk::ImageSubresourceRange(Aspect(r.info.format), 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS))
+            );
+        }
+
+        void Record(CommandBuffer& buffer, Batch& batch)
+        {
+            if (batch.barriers.empty())
+                return;
+            for (size_t x = 0; x < batch.barriers.size(); x++)
+            {
+                batch.barriers[x].setImage(resources[batch.resources[x]].image);
+            }
+            buffer.pipelineBarrier(
+                batch.src ? batch.src : vk::PipelineStageFlagBits::eTopOfPipe,
+                batch.dst ? batch.dst : vk::PipelineStageFlagBits::eBottomOfPipe,
+                {}, {}, {}, batch.barriers);
+        }
+
+        void Release()
+        {
+            std::vector<vk::ImageView> views;
+            std::vector<vk::Image> images;
+            for (auto& r : resources)
+            {
+                if (!r.imported && r.image)
+                {
+                    views.push_back(r.view);
+                    images.push_back(r.image);
+                    r.image = nullptr;
+                    r.view = nullptr;
+                }
+            }
+            compiled.clear();
+            end = {};
+            if (images.empty() && memory.empty())
+                return;
+            framebuffers->Evict(views);
+
+            vk::Device handle = *device;
+            auto allocator = &device->GetAllocator();
+            device->GetDeletionQueue().Push([handle, allocator, views, images, memory = memory]() {
+                for (auto view : views)
+                    handle.destroyImageView(view);
+                for (auto image : images)
+                    handle.destroyImage(image);
+                for (auto& allocation : memory)
+                    allocator->Free(allocation);
+            });
+            memory.clear();
+        }
+
+        // Reverse walk: a pass is live when it has side effects, writes an imported image or writes something a
+        // later live pass uses. Clearing an attachment ends the dependency on whoever wrote it before.
+        std::vector<bool> Cull()
+        {
+            std::vector<bool> live(passes.size(), false);
+            std::vector<bool> needed(resources.size(), false);
+            for (size_t x = passes.size(); x-- > 0;)
+            {
+                auto& pass = passes[x];
+                for (auto& use : pass.uses)
+                {
+                    auto r = Find(use.resource);
+                    if (use.write && (needed[r] || resources[r].imported))
+                        live[x] = true;
+                }
+                if (!live[x] && !pass.side_effects)
+                    continue;
+                live[x] = true;
+                for (auto& use : pass.uses)
+                {
+                    auto r = Find(use.resource);
+                    needed[r] = !use.write || !pass.clears.count(use.resource);
+                }
+            }
+            return live;
+        }
+
+        void CreateTransients()
+        {
+            std::vector<uint32_t> order;
+            for (uint32_t x = 0; x < resources.size(); x++)
+            {
+                auto& r = resources[x];
+                if (r.imported || r.first == UINT32_MAX)
+                    continue;
+                r.image = device->createImage(
+                    vk::ImageCreateInfo()
+                        .setImageType(vk::ImageType::e2D)
+                        .setExtent(vk::Extent3D(Size(r), 1))
+                        .setFormat(r.info.format)
+                        .setUsage(r.usage)
+                        .setTiling(vk::ImageTiling::eOptimal)
+                        .setSamples(r.info.samples)
+                        .setMipLevels(1)
+                        .setArrayLayers(1)
+                        .setSharingMode(vk::SharingMode::eExclusive)
+                        .setInitialLayout(vk::ImageLayout::eUndefined)
+                );
+                r.requirements = device->getImageMemoryRequirements(r.image);
+                stats.transient_bytes += r.requirements.size;
+                order.push_back(x);
+            }
+
+            // Largest first into the first slot whose memory type fits and whose images are all dead by the time
+            // this one is first used, or alive only after it is last used. The first image sets a slot's size.
+            std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+                return resources[a].requirements.size > resources[b].requirements.size;
+            });
+            slots.clear();
+            for (auto x : order)
+            {
+                auto& r = resources[x];
+                Slot* found = nullptr;
+                for (auto& slot : slots)
+                {
+                    if (!aliasing || !(slot.requirements.memoryTypeBits & r.requirements.memoryTypeBits))
+                        continue;
+                    auto overlaps = std::any_of(slot.resources.begin(), slot.resources.end(), [&](auto other) {
+                        return !(resources[other].last < r.first || r.last < resources[other].first);
+                    });
+                    if (!overlaps)
+                    {
+                        found = &slot;
+                        break;
+                    }
+                }
+                if (!found)
+                {
+                    found = &slots.emplace_back();
+                    found->requirements = r.requirements;
+                }
+                found->requirements.size = std::max(found->requirements.size, r.requirements.size);
+                found->requirements.alignment = std::max(found->requirements.alignment, r.requirements.alignment);
+                found->requirements.memoryTypeBits &= r.requirements.memoryTypeBits;
+                found->resources.push_back(x);
+            }
+
+            for (uint32_t s = 0; s < slots.size(); s++)
+            {
+                auto& slot = slots[s];
+                auto allocation = device->GetAllocator().Allocate(slot.requirements, MemoryUsage::GPU_ONLY, false);
+                memory.push_back(allocation);
+                stats.allocated_bytes += slot.requirements.size;
+                // Within a slot the images run in pass order, each waiting on the one before it.
+                std::sort(slot.resources.begin(), slot.resources.end(), [&](auto a, auto b) {
+                    return resources[a].first < resources[b].first;
+                });
+                for (auto x : slot.resources)
+                {
+                    auto& r = resources[x];
+                    r.slot = s;
+                    device->bindImageMemory(r.image, allocation.memory, allocation.offset);
+                    r.view = device->createImageView(
+                        vk::ImageViewCreateInfo()
+                            .setImage(r.image)
+                            .setViewType(vk::ImageViewType::e2D)
+                            .setFormat(r.info.format)
+                            .setSubresourceRange(vk::ImageSubresourceRange(
+                                r.usage & vk::ImageUsageFlagBits::eSampled ? Aspect(r.info.format) & ~vk::ImageAspectFlagBits::eStencil : Aspect(r.info.format), 0, 1, 0, 1))
+                    );
+                }
+            }
+        }
+
+        // Walks every resource through its uses in live pass order. Layout changes and writes wait on the previous
+        // use, reads only when an earlier barrier did not already make the last write visible to their stage.
+        void BuildBarriers(const std::vector<uint32_t>& live)
+        {
+            struct State
+            {
+                vk::ImageLayout layout;
+                vk::PipelineStageFlags write_stages;
+                vk::AccessFlags write_access;
+                vk::PipelineStageFlags read_stages;
+                vk::AccessFlags read_access;
+            };
+            // First use of each transient, its source is the previous image in the slot and only known at the end.
+            std::vector<std::pair<uint32_t, size_t>> first_uses(resources.size(), {UINT32_MAX, 0});
+
+            std::vector<State> states(resources.size());
+            for (uint32_t x = 0; x < resources.size(); x++)
+            {
+                auto& r = resources[x];
+                states[x] = State{r.imported ? r.initial : vk::ImageLayout::eUndefined,
+                    r.imported ? r.import_stages : vk::PipelineStageFlags(), r.imported ? r.import_access : vk::AccessFlags(), {}, {}};
+            }
+
+            for (uint32_t c = 0; c < live.size(); c++)
+            {
+                auto& pass = passes[live[c]];
+                auto graphics = IsGraphics(pass);
+                auto& batch = compiled[c].batch;
+                for (auto& use : pass.uses)
+                {
+                    auto x = Find(use.resource);
+                    auto& s = states[x];
+                    auto want = Info(use.access, graphics);
+                    if (s.layout != want.layout || use.write)
+                    {
+                        if (!resources[x].imported && first_uses[x].first == UINT32_MAX)
+                            first_uses[x] = {c, batch.barriers.size()};
+                        // After reads the last write has already been waited on, only the readers are left to order.
+                        if (s.read_stages)
+                            Add(batch, x, s.read_stages, {}, want.stages, want.access, s.layout, want.layout);
+                        else
+                            Add(batch, x, s.write_stages, s.write_access, want.stages, want.access, s.layout, want.layout);
+
+                        if (use.write)
+                        {
+                            s = State{want.layout, want.stages, Writes(want.access), {}, {}};
+                        }
+                        else
+                        {
+                            // Later readers chain through this barrier's stages to see the transition.
+                            s.layout = want.layout;
+                            s.write_stages |= want.stages;
+                            s.read_stages = want.stages;
+                            s.read_access = want.access;
+                        }
+                    }
+                    else if ((want.stages & ~s.read_stages) || (want.access & ~s.read_access))
+                    {
+                        if (s.write_stages)
+                            Add(batch, x, s.write_stages, s.write_access, want.stages, want.access, s.layout, s.layout);
+                        s.read_stages |= want.stages;
+                        s.read_access |= want.access;
+                    }
+                }
+            }
+
+            for (uint32_t x = 0; x < resources.size(); x++)
+            {
+                auto& r = resources[x];
+                auto& s = states[x];
+                r.end_stages = s.write_stages | s.read_stages;
+                r.end_access = s.write_access;
+                if (r.imported && r.final_layout != s.layout)
+                    Add(end, x, r.end_stages, r.end_access, {}, {}, s.layout, r.final_layout);
+            }
+
+            // A transient waits on the image before it in its slot, the first one in a slot on the last one, which
+            // is how the previous Execute left the memory.
+            for (auto& slot : slots)
+            {
+                for (size_t y = 0; y < slot.resources.size(); y++)
+                {
+                    auto x = slot.resources[y];
+                    auto previous = slot.resources[(y + slot.resources.size() - 1) % slot.resources.size()];
+                    auto [c, index] = first_uses[x];
+                    if (c == UINT32_MAX)
+                        continue;
+                    auto& batch = compiled[c].batch;
+                    batch.src |= resources[previous].end_stages;
+                    batch.barriers[index].setSrcAccessMask(resources[previous].end_access);
+                }
+            }
+        }
+
+        void BuildRenderpasses(const std::vector<uint32_t>& live)
+        {
+            // Whether an earlier live pass touched the resource this frame, and whether a later one will.
+            std::vector<uint32_t> last(resources.size(), UINT32_MAX);
+            for (uint32_t c = 0; c < live.size(); c++)
+            {
+                for (auto& use : passes[live[c]].uses)
+                    last[Find(use.resource)] = c;
+            }
+            std::vector<bool> written(resources.size(), false);
+            for (uint32_t x = 0; x < resources.size(); x++)
+            {
+                written[x] = resources[x].imported && resources[x].initial != vk::ImageLayout::eUndefined;
+            }
+
+            for (uint32_t c = 0; c < live.size(); c++)
+            {
+                auto& pass = passes[live[c]];
+                auto& out = compiled[c];
+                std::vector<std::pair<std::string, Attachment>> attachments;
+                Description description;
+                for (auto& use : pass.uses)
+                {
+                    auto x = Find(use.resource);
+                    auto& r = resources[x];
+                    if (use.access == GraphAccess::COLOR || use.access == GraphAccess::DEPTH)
+                    {
+                        auto cleared = pass.clears.find(use.resource);
+                        auto layout = Info(use.access, true).layout;
+                        attachments.push_back({use.resource, Attachment{
+                            .load = cleared != pass.clears.end() ? vk::AttachmentLoadOp::eClear
+                                : written[x] ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eDontCare,
+                            .store = r.imported || last[x] > c ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare,
+                            .format = r.info.format,
+                            .samples = r.info.samples,
+                            .initial_layout = layout,
+                            .final_layout = layout,
+                        }});
+                        out.attachments.push_back(x);
+                        out.clears.push_back(cleared != pass.clears.end() ? cleared->second : vk::ClearValue());
+                        if (use.access == GraphAccess::COLOR)
+                            description.color.push_back(use.resource);
+                        else
+                            description.depth = use.resource;
+                    }
+                    written[x] = written[x] || use.write;
+                }
+                if (attachments.empty())
+                    continue;
+                out.renderpass = renderpasses->Get(RenderpassBuilder()
+                    .AddAttachments(attachments)
+                    .AddSubpassDescription(description)
+                    .SetExternalDependencies({}));
+            }
+        }
+
+        public:
+        RenderGraph(std::shared_ptr<Device> device, std::shared_ptr<RenderpassCache> renderpasses, std::shared_ptr<FramebufferCache> framebuffers, bool aliasing):
+        device(device), renderpasses(renderpasses), framebuffers(framebuffers), aliasing(aliasing)
+        {}
+
+        ~RenderGraph()
+        {
+            Release();
+        }
+
+        // Declares an image that only lives within a frame, created and owned by the graph.
+        void CreateImage(const std::string& name, GraphImageInfo info)
+        {
+            if (names.count(name))
+                throw(std::exception(("Render graph resource declared twice: " + name).c_str()));
+            names[name] = static_cast<uint32_t>(resources.size());
+            auto& r = resources.emplace_back();
+            r.name = name;
+            r.info = info;
+        }
+
+        // Declares an image owned elsewhere, e.g. a swapchain image. It is expected in layout when Execute starts,
+        // with whatever wrote it before waited on at stages and made available from access, and left in final_layout,
+        // which defaults to layout. Passes writing it are never culled.
+        void ImportImage(const std::string& name, vk::Image image, vk::ImageView view, GraphImageInfo info,
+            vk::ImageLayout layout, vk::ImageLayout final_layout = vk::ImageLayout::eUndefined,
+            vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eAllCommands,
+            vk::AccessFlags access = vk::AccessFlagBits::eMemoryWrite)
+        {
+            CreateImage(name, info);
+            auto& r = resources.back();
+            r.imported = true;
+            r.image = image;
+            r.view = view;
+            r.initial = layout;
+            r.final_layout = final_layout == vk::ImageLayout::eUndefined ? layout : final_layout;
+            r.import_stages = stages;
+            r.import_access = access;
+        }
+
+        // Points an imported image at another image of the same format and extent, e.g. the acquired swapchain
+        // image. Framebuffers for it stay in the framebuffer cache, whoever destroys the view has to evict it there.
+        void SetImportedImage(const std::string& name, vk::Image image, vk::ImageView view)
+        {
+            auto& r = resources[Find(name)];
+            if (!r.imported)
+                throw(std::exception("Only imported images can be replaced"));
+            r.image = image;
+            r.view = view;
+        }
+
+        // The reference stays valid as passes are added.
+        GraphPass& AddPass(const std::string& name)
+        {
+            return passes.emplace_back(name);
+        }
+
+        // Culls, allocates and plans barriers for everything declared so far. Call again after adding passes or when
+        // extent changes, the previous images and their framebuffers are retired through the deletion queue. Render
+        // passes come from the cache, a resize hands back the same ones, so pipelines built against them stay valid.
+        void Compile(vk::Extent2D extent)
+        {
+            Release();
+            stats = {};
+            for (auto& r : resources)
+            {
+                r.first = UINT32_MAX;
+                r.last = 0;
+                r.usage = {};
+                r.slot = UINT32_MAX;
+            }
+
+            auto alive = Cull();
+            std::vector<uint32_t> live;
+            for (uint32_t x = 0; x < passes.size(); x++)
+            {
+                if (alive[x])
+                    live.push_back(x);
+            }
+            stats.passes = static_cast<uint32_t>(live.size());
+            stats.culled = static_cast<uint32_t>(passes.size() - live.size());
+
+            for (uint32_t c = 0; c < live.size(); c++)
+            {
+                auto& pass = passes[live[c]];
+                auto graphics = IsGraphics(pass);
+                for (auto& use : pass.uses)
+                {
+                    auto& r = resources[Find(use.resource)];
+                    if (!r.imported && r.first == UINT32_MAX && !use.write)
+                        throw(std::exception(("Render graph resource read before any pass writes it: " + r.name).c_str()));
+                    r.first = std::min(r.first, c);
+                    r.last = std::max(r.last, c);
+                    r.usage |= Info(use.access, graphics).usage;
+                }
+                compiled.push_back(Compiled{live[c]});
+            }
+
+            this->extent = extent;
+            CreateTransients();
+            BuildBarriers(live);
+            BuildRenderpasses(live);
+
+            for (auto& c : compiled)
+            {
+                stats.barriers += c.batch.barriers.empty() ? 0 : 1;
+                stats.image_barriers += static_cast<uint32_t>(c.batch.barriers.size());
+            }
+            stats.barriers += end.barriers.empty() ? 0 : 1;
+            stats.image_barriers += static_cast<uint32_t>(end.barriers.size());
+
+            info("Render graph: " + std::to_string(stats.passes) + " passes, " + std::to_string(stats.culled) + " culled, "
+                + std::to_string(stats.image_barriers) + " image barriers in " + std::to_string(stats.barriers) + " batches, "
+                + std::to_string(stats.Saved() / 1024) + " KiB of " + std::to_string(stats.transient_bytes / 1024)
+                + " KiB saved by aliasing");
+        }
+
+        // Records the live passes with their barriers, outside of any render pass.
+        void Execute(CommandBuffer& buffer)
+        {
+            for (auto& c : compiled)
+            {
+                auto& pass = passes[c.pass];
+                Record(buffer, c.batch);
+                if (!c.renderpass)
+                {
+                    if (pass.execute)
+                        pass.execute(buffer);
+                    continue;
+                }
+
+                FramebufferBuilder builder;
+                for (auto x : c.attachments)
+                {
+                    builder.AddAttachment(resources[x].view);
+                }
+                auto framebuffer = framebuffers->Get(builder, Size(resources[c.attachments.front()]), c.renderpass);
+                buffer.bindFramebuffer(*framebuffer, vk::SubpassContents::eInline, c.clears);
+                if (pass.execute)
+                    pass.execute(buffer);
+                buffer.endRenderPass();
+            }
+            Record(buffer, end);
+        }
+
+        vk::ImageView View(const std::string& name)
+        {
+            return resources[Find(name)].view;
+        }
+
+        vk::Image GetImage(const std::string& name)
+        {
+            return resources[Find(name)].image;
+        }
+
+        // nullptr for culled passes and passes without attachments. Valid after Compile.
+        std::shared_ptr<Renderpass> GetRenderpass(const std::string& pass)
+        {
+            for (auto& c : compiled)
+            {
+                if (passes[c.pass].name == pass)
+                    return c.renderpass;
+            }
+            return nullptr;
+        }
+
+        bool IsCulled(const std::string& pass)
+        {
+            return std::none_of(compiled.begin(), compiled.end(), [&](auto& c) { return passes[c.pass].name == pass; });
+        }
+
+        auto GetStats()
+        {
+            return stats;
+        }
+    };
+};
+
+using RenderGraph = std::shared_ptr<inner::RenderGraph>;
+
+class RenderGraphBuilder
+{
+    private:
+    bool m_Aliasing = true;
+    RenderpassCache m_Renderpasses;
+    FramebufferCache m_Framebuffers;
+    public:
+    // Gives every transient image its own memory, to compare against or to rule aliasing out when debugging.
+    auto SetAliasing(bool aliasing)
+    {
+        m_Aliasing = aliasing;
+        return *this;
+    }
+
+    // Shares render passes and framebuffers with other users of the caches, by default the graph has its own.
+    auto SetCaches(RenderpassCache renderpasses, FramebufferCache framebuffers)
+    {
+        m_Renderpasses = renderpasses;
+        m_Framebuffers = framebuffers;
+        return *this;
+    }
+
+    auto Build(Device device)
+    {
+        auto renderpasses = m_Renderpasses ? m_Renderpasses : RenderpassCacheBuilder().Build(device);
+        auto framebuffers = m_Framebuffers ? m_Framebuffers : FramebufferCacheBuilder().Build(device);
+        return std::make_shared<inner::RenderGraph>(device, renderpasses, framebuffers, m_Aliasing);
+    }
+};
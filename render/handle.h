@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#include "pool.h"
+#include "memory.h"
+
+// Index into a HandlePool plus the generation of the slot when it was handed out. A handle to an object that has
+// been removed since resolves to nullptr instead of to whatever reused the slot.
+template <typename T>
+struct Handle
+{
+    public:
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    explicit operator bool() const
+    {
+        return index != UINT32_MAX;
+    }
+
+    bool operator==(const Handle& other) const = default;
+};
+
+// Owns objects in dense slots and hands out Handles to them. Get is an index and a generation compare, so code on
+// the recording path can carry handles around and resolve them without touching a reference count. Removing an
+// object drops the pool's reference, the wrapper's destructor then retires the Vulkan object through the device's
+// deletion queue, so command buffers still in flight are not affected.
+template <typename T>
+class HandlePool
+{
+    private:
+    std::vector<T*> objects;
+    std::vector<uint32_t> generations;
+    std::vector<std::shared_ptr<T>> owners;
+    std::vector<uint32_t> free;
+    size_t count = 0;
+    public:
+    Handle<T> Insert(std::shared_ptr<T> object)
+    {
+        uint32_t index;
+        if (!free.empty())
+        {
+            index = free.back();
+            free.pop_back();
+        }
+        else
+        {
+            index = static_cast<uint32_t>(objects.size());
+            objects.push_back(nullptr);
+            generations.push_back(0);
+            owners.emplace_back();
+        }
+        objects[index] = object.get();
+        owners[index] = std::move(object);
+        count++;
+        return Handle<T>{index, generations[index]};
+    }
+
+    T* Get(Handle<T> handle) const
+    {
+        if (handle.index >= objects.size() || generations[handle.index] != handle.generation)
+            return nullptr;
+        return objects[handle.index];
+    }
+
+    // Shared ownership for code off the hot path that needs the object to outlive its slot, e.g. a builder.
+    std::shared_ptr<T> Share(Handle<T> handle) const
+    {
+        return Get(handle) ? owners[handle.index] : nullptr;
+    }
+
+    bool Contains(Handle<T> handle) const
+    {
+        return Get(handle) != nullptr;
+    }
+
+    void Remove(Handle<T> handle)
+    {
+        if (!Contains(handle))
+            return;
+        objects[handle.index] = nullptr;
+        generations[handle.index]++;
+        owners[handle.index].reset();
+        free.push_back(handle.index);
+        count--;
+    }
+
+    size_t Size() const
+    {
+        return count;
+    }
+};
+
+using PipelineHandle = Handle<inner::Pipeline>;
+using FramebufferHandle = Handle<inner::Framebuffer>;
+using BufferHandle = Handle<inner::Buffer>;
+using ImageHandle = Handle<inner::Image>;
+
+// The pools for the objects draws refer to. Meant to be owned by whatever records, next to the Device.
+struct ResourcePools
+{
+    public:
+    HandlePool<inner::Pipeline> pipelines;
+    HandlePool<inner::Framebuffer> framebuffers;
+    HandlePool<inner::Buffer> buffers;
+    HandlePool<inner::Image> images;
+};
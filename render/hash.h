@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+// A hash together with the bytes it was computed from. Caches key on this rather than the bare hash, so two
+// descriptions that collide compare unequal instead of sharing an object.
+struct HashKey
+{
+    public:
+    uint64_t hash = 0;
+    std::string bytes;
+
+    bool operator==(const HashKey& other) const
+    {
+        return hash == other.hash && bytes == other.bytes;
+    }
+};
+
+template <>
+struct std::hash<HashKey>
+{
+    size_t operator()(const HashKey& key) const
+    {
+        return static_cast<size_t>(key.hash);
+    }
+};
+
+// FNV-1a over explicitly added fields, so padding and pointers inside Vulkan structs never end up in a key.
+class Hasher
+{
+    private:
+    uint64_t hash = 14695981039346656037ull;
+    std::string bytes;
+
+    public:
+    template <typename T>
+    auto& Add(T value) requires std::is_integral_v<T> || std::is_enum_v<T> || std::is_floating_point_v<T>
+    {
+        auto data = reinterpret_cast<const unsigned char*>(&value);
+        for (size_t x = 0; x < sizeof(T); x++)
+        {
+            hash = (hash ^ data[x]) * 1099511628211ull;
+        }
+        bytes.append(reinterpret_cast<const char*>(data), sizeof(T));
+        return *this;
+    }
+
+    template <typename T>
+    auto& Add(vk::Flags<T> flags)
+    {
+        return Add(static_cast<typename vk::Flags<T>::MaskType>(flags));
+    }
+
+    auto& Add(const std::string& value)
+    {
+        Add(value.size());
+        for (auto c : value)
+        {
+            Add(c);
+        }
+        return *this;
+    }
+
+    // Vulkan handles are hashed by their raw value.
+    template <typename T>
+    auto& Add(T handle) requires requires { typename T::CType; T::objectType; }
+    {
+        return Add(reinterpret_cast<uint64_t>(static_cast<typename T::CType>(handle)));
+    }
+
+    auto& Add(const HashKey& key)
+    {
+        Add(key.hash);
+        return Add(key.bytes);
+    }
+
+    template <typename T>
+    auto& Add(const std::vector<T>& values)
+    {
+        Add(values.size());
+        for (auto& value : values)
+        {
+            Add(value);
+        }
+        return *this;
+    }
+
+    template <typename T, size_t N>
+    auto& Add(const std::array<T, N>& values)
+    {
+        for (auto& value : values)
+        {
+            Add(value);
+        }
+        return *this;
+    }
+
+    auto Get()
+    {
+        return hash;
+    }
+
+    HashKey Key() const
+    {
+        return HashKey{hash, bytes};
+    }
+};
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+// SHA-256 for data where a match has to mean equal contents, without keeping the contents around to compare.
+inline Sha256Digest Sha256(const void* data, size_t size)
+{
+    static constexpr uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    auto rotate = [](uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); };
+    auto compress = [&](const uint8_t* block)
+    {
+        uint32_t w[64];
+        for (int x = 0; x < 16; x++)
+        {
+            w[x] = uint32_t(block[x * 4]) << 24 | uint32_t(block[x * 4 + 1]) << 16 | uint32_t(block[x * 4 + 2]) << 8 | block[x * 4 + 3];
+        }
+        for (int x = 16; x < 64; x++)
+        {
+            auto s0 = rotate(w[x - 15], 7) ^ rotate(w[x - 15], 18) ^ (w[x - 15] >> 3);
+            auto s1 = rotate(w[x - 2], 17) ^ rotate(w[x - 2], 19) ^ (w[x - 2] >> 10);
+            w[x] = w[x - 16] + s0 + w[x - 7] + s1;
+        }
+        auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int x = 0; x < 64; x++)
+        {
+            auto t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[x] + w[x];
+            auto t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    };
+
+    auto bytes = static_cast<const uint8_t*>(data);
+    auto full = size / 64 * 64;
+    for (size_t x = 0; x < full; x += 64)
+    {
+        compress(bytes + x);
+    }
+
+    // The tail, the 0x80 marker and the bit length take one or two more blocks.
+    uint8_t tail[128] = {};
+    auto rest = size - full;
+    std::copy(bytes + full, bytes + size, tail);
+    tail[rest] = 0x80;
+    auto blocks = rest < 56 ? 1 : 2;
+    auto bits = static_cast<uint64_t>(size) * 8;
+    for (int x = 0; x < 8; x++)
+    {
+        tail[blocks * 64 - 1 - x] = static_cast<uint8_t>(bits >> (x * 8));
+    }
+    for (int x = 0; x < blocks; x++)
+    {
+        compress(tail + x * 64);
+    }
+
+    Sha256Digest digest;
+    for (int x = 0; x < 8; x++)
+    {
+        digest[x * 4] = static_cast<uint8_t>(state[x] >> 24);
+        digest[x * 4 + 1] = static_cast<uint8_t>(state[x] >> 16);
+        digest[x * 4 + 2] = static_cast<uint8_t>(state[x] >> 8);
+        digest[x * 4 + 3] = static_cast<uint8_t>(state[x]);
+    }
+    return digest;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+#include "pool.h"
+#include "memory.h"
+#include "upload.h"
+
+// Bounding sphere of one object in world space, xyz center and w radius. Matches the vec4 array in cull.comp.
+struct ObjectBounds
+{
+    public:
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+    float radius = 0.0f;
+};
+
+// Planes with normals pointing inside, a point p is inside a plane when dot(normal, p) + d >= 0.
+struct Frustum
+{
+    public:
+    std::array<std::array<float, 4>, 6> planes = {};
+
+    // From a column major view projection matrix with Vulkan's [0, 1] depth range.
+    static Frustum FromMatrix(const float* m)
+    {
+        auto row = [&](int r) { return std::array<float, 4>{m[r], m[4 + r], m[8 + r], m[12 + r]}; };
+        auto r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+        Frustum frustum;
+        for (int x = 0; x < 4; x++)
+        {
+            frustum.planes[0][x] = r3[x] + r0[x];
+            frustum.planes[1][x] = r3[x] - r0[x];
+            frustum.planes[2][x] = r3[x] + r1[x];
+            frustum.planes[3][x] = r3[x] - r1[x];
+            frustum.planes[4][x] = r2[x];
+            frustum.planes[5][x] = r3[x] - r2[x];
+        }
+        for (auto& plane : frustum.planes)
+        {
+            auto length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            if (length > 0.0f)
+            {
+                for (auto& value : plane)
+                    value /= length;
+            }
+        }
+        return frustum;
+    }
+};
+
+namespace inner
+{
+    // GPU driven drawing of up to capacity objects. Bounds and draw commands live in storage buffers, Cull runs
+    // cull.comp over them and Draw consumes the result with one indirect call, so the CPU cost per frame does not
+    // depend on the object count. With drawIndirectCount and multiDrawIndirect the visible draws are compacted and
+    // counted on the GPU, without drawIndirectCount every draw is kept and culled ones get zero instances, and
+    // without multiDrawIndirect Draw falls back to one indirect call per object.
+    class IndirectDrawer
+    {
+        private:
+        struct PushConstants
+        {
+            std::array<std::array<float, 4>, 6> planes;
+            uint32_t object_count;
+        };
+
+        std::shared_ptr<Device> device;
+        std::shared_ptr<Pipeline> pipeline;
+        std::shared_ptr<Buffer> bounds;
+        std::shared_ptr<Buffer> commands;
+        std::shared_ptr<Buffer> visible;
+        std::shared_ptr<Buffer> count;
+        vk::DescriptorPool descriptor_pool;
+        vk::DescriptorSet set;
+        uint32_t capacity;
+        uint32_t objects = 0;
+        bool compact;
+
+        public:
+        IndirectDrawer(std::shared_ptr<Device> device, std::shared_ptr<Pipeline> pipeline, uint32_t capacity, bool compact):
+        device(device), pipeline(pipeline), capacity(capacity), compact(compact)
+        {
+            auto stride = sizeof(vk::DrawIndexedIndirectCommand);
+            auto storage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+            bounds = BufferBuilder().SetSize(sizeof(ObjectBounds) * capacity).SetUsage(storage).Build(device);
+            commands = BufferBuilder().SetSize(stride * capacity).SetUsage(storage).Build(device);
+            visible = BufferBuilder().SetSize(stride * capacity).SetUsage(storage | vk::BufferUsageFlagBits::eIndirectBuffer).Build(device);
+            count = BufferBuilder().SetSize(sizeof(uint32_t)).SetUsage(storage | vk::BufferUsageFlagBits::eIndirectBuffer).Build(device);
+
+            auto size = vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 4);
+            descriptor_pool = device->createDescriptorPool(
+                vk::DescriptorPoolCreateInfo()
+                    .setMaxSets(1)
+                    .setPoolSizes(size)
+            );
+            set = device->allocateDescriptorSets(
+                vk::DescriptorSetAllocateInfo()
+                    .setDescriptorPool(descriptor_pool)
+                    .setSetLayouts(device->GetLayoutCache().GetSetLayouts(pipeline->Layout()).at(0))
+            ).front();
+
+            const std::array<vk::DescriptorBufferInfo, 4> infos =
+            {
+                vk::DescriptorBufferInfo(*bounds, 0, VK_WHOLE_SIZE),
+                vk::DescriptorBufferInfo(*commands, 0, VK_WHOLE_SIZE),
+                vk::DescriptorBufferInfo(*visible, 0, VK_WHOLE_SIZE),
+                vk::DescriptorBufferInfo(*count, 0, VK_WHOLE_SIZE),
+            };
+            std::array<vk::WriteDescriptorSet, 4> writes;
+            for (uint32_t x = 0; x < writes.size(); x++)
+            {
+                writes[x] = vk::WriteDescriptorSet()
+                    .setDstSet(set)
+                    .setDstBinding(x)
+                    .setDescriptorCount(1)
+                    .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                    .setPBufferInfo(&infos[x]);
+            }
+            device->updateDescriptorSets(writes, {});
+        }
+
+        ~IndirectDrawer()
+        {
+            device->Retire(descriptor_pool);
+        }
+
+        // Uploads bounds and commands for objects [0, bounds.size()) through the upload manager, the graphics side has
+        // to call UploadManager::Acquire before the next Cull. first_instance is how shaders find their object, which
+        // indirect draws only honour with drawIndirectFirstInstance.
+        void Update(UploadManager& uploads, const std::vector<ObjectBounds>& object_bounds, const std::vector<vk::DrawIndexedIndirectCommand>& draws)
+        {
+            if (object_bounds.size() != draws.size())
+                throw(std::exception("Every object needs bounds and a draw command"));
+            if (object_bounds.size() > capacity)
+                throw(std::exception("More objects than the indirect drawer was built for"));
+            if (!device->Features().drawIndirectFirstInstance)
+            {
+                for (auto& draw : draws)
+                {
+                    if (draw.firstInstance != 0)
+                        throw(std::exception("firstInstance has to be 0 without drawIndirectFirstInstance"));
+                }
+            }
+            objects = static_cast<uint32_t>(object_bounds.size());
+            if (objects == 0)
+                return;
+            uploads.Upload(*bounds, 0, object_bounds.data(), sizeof(ObjectBounds) * objects);
+            uploads.Upload(*commands, 0, draws.data(), sizeof(vk::DrawIndexedIndirectCommand) * objects);
+        }
+
+        // Records the culling dispatch, outside of a render pass and before Draw in the same or an earlier submission.
+        void Cull(CommandBuffer& buffer, const Frustum& frustum)
+        {
+            if (objects == 0)
+                return;
+
+            // Last frame's draws may still read visible and count.
+            if (compact)
+            {
+                buffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eDrawIndirect,
+                    vk::PipelineStageFlagBits::eTransfer,
+                    {}, {}, {}, {});
+                buffer.fillBuffer(*count, 0, sizeof(uint32_t), 0);
+            }
+            buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eDrawIndirect,
+                vk::PipelineStageFlagBits::eComputeShader,
+                {},
+                vk::MemoryBarrier()
+                    .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                    .setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite),
+                {}, {});
+
+            PushConstants constants{frustum.planes, objects};
+            buffer.bindPipeline(*pipeline);
+            buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline->Layout(), 0, set, {});
+            buffer.pushConstants(pipeline->Layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+            buffer.dispatch((objects + 63) / 64, 1, 1);
+
+            buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eComputeShader,
+                vk::PipelineStageFlagBits::eDrawIndirect,
+                {},
+                vk::MemoryBarrier()
+                    .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                    .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead),
+                {}, {});
+        }
+
+        // Inside the render pass, with the graphics pipeline, vertex and index buffers bound by the caller.
+        void Draw(CommandBuffer& buffer)
+        {
+            if (objects == 0)
+                return;
+            auto stride = static_cast<uint32_t>(sizeof(vk::DrawIndexedIndirectCommand));
+            if (compact)
+            {
+                buffer.drawIndexedIndirectCount(*visible, 0, *count, 0, objects, stride);
+            }
+            else if (device->Features().multiDrawIndirect)
+            {
+                buffer.drawIndexedIndirect(*visible, 0, objects, stride);
+            }
+            else
+            {
+                for (uint32_t x = 0; x < objects; x++)
+                {
+                    buffer.drawIndexedIndirect(*visible, x * stride, 1, stride);
+                }
+            }
+        }
+
+        auto Capacity()
+        {
+            return capacity;
+        }
+
+        auto Objects()
+        {
+            return objects;
+        }
+
+        auto IsCompacting()
+        {
+            return compact;
+        }
+    };
+};
+
+using IndirectDrawer = std::shared_ptr<inner::IndirectDrawer>;
+
+class IndirectDrawerBuilder
+{
+    private:
+    uint32_t m_Capacity = 65536;
+    std::string m_Shader = "../../shaders/cull.spv";
+    public:
+    auto SetCapacity(uint32_t objects)
+    {
+        m_Capacity = std::max(objects, 1u);
+        return *this;
+    }
+
+    // Compiled from shaders/cull.comp.
+    auto SetShader(const std::string& path)
+    {
+        m_Shader = path;
+        return *this;
+    }
+
+    auto Build(Device device)
+    {
+        auto compact = device->HasDrawIndirectCount() && device->Features().multiDrawIndirect;
+        auto pipeline = ComputePipelineBuilder(device)
+            .AddShaderFromFile(m_Shader, vk::ShaderStageFlagBits::eCompute)
+            .SetSpecialization(SpecializationConstants().Set(0, compact))
+            .Build();
+        return std::make_shared<inner::IndirectDrawer>(device, pipeline, m_Capacity, compact);
+    }
+};
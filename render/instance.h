@@ -162,7 +162,10 @@ public:
 
     auto Build()
     {
-        auto instanceCreateInfo = vk::InstanceCreateInfo();
+        auto application = vk::ApplicationInfo()
+            .setApiVersion(VK_API_VERSION_1_2);
+        auto instanceCreateInfo = vk::InstanceCreateInfo()
+            .setPApplicationInfo(&application);
         bool validation = false;
         if (m_ValidationLayers.size() > 0)
         {
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "hash.h"
+#include "shader.h"
+
+namespace inner
+{
+    // Descriptor set and pipeline layouts keyed by their contents. Pipelines built from the same
+    // interface get the same vk::PipelineLayout, so bound descriptor sets stay valid across pipeline switches.
+    class LayoutCache
+    {
+        private:
+        vk::Device device;
+        std::mutex mutex;
+        std::unordered_map<HashKey, vk::DescriptorSetLayout> set_layouts;
+        std::unordered_map<HashKey, vk::PipelineLayout> pipeline_layouts;
+        std::unordered_map<VkPipelineLayout, std::vector<vk::DescriptorSetLayout>> layout_sets;
+
+        public:
+        LayoutCache(vk::Device device):
+        device(device)
+        {}
+
+        ~LayoutCache()
+        {
+            for (auto& [key, layout] : pipeline_layouts)
+            {
+                device.destroyPipelineLayout(layout);
+            }
+            for (auto& [key, layout] : set_layouts)
+            {
+                device.destroyDescriptorSetLayout(layout);
+            }
+        }
+
+        vk::DescriptorSetLayout GetSetLayout(std::vector<vk::DescriptorSetLayoutBinding> bindings, vk::DescriptorSetLayoutCreateFlags flags = {})
+        {
+            std::sort(bindings.begin(), bindings.end(), [](auto& a, auto& b) { return a.binding < b.binding; });
+
+            Hasher hasher;
+            hasher.Add(flags).Add(bindings.size());
+            for (auto& binding : bindings)
+            {
+                hasher.Add(binding.binding).Add(binding.descriptorType).Add(binding.descriptorCount).Add(binding.stageFlags)
+                    .Add(binding.pImmutableSamplers != nullptr);
+                for (uint32_t x = 0; binding.pImmutableSamplers && x < binding.descriptorCount; x++)
+                {
+                    hasher.Add(binding.pImmutableSamplers[x]);
+                }
+            }
+            auto key = hasher.Key();
+
+            std::lock_guard lock(mutex);
+            auto& layout = set_layouts[key];
+            if (!layout)
+            {
+                layout = device.createDescriptorSetLayout(
+                    vk::DescriptorSetLayoutCreateInfo()
+                    .setFlags(flags)
+                    .setBindings(bindings)
+                );
+            }
+            return layout;
+        }
+
+        vk::PipelineLayout GetPipelineLayout(const vk::PipelineLayoutCreateInfo& info)
+        {
+            Hasher hasher;
+            hasher.Add(info.flags).Add(info.setLayoutCount);
+            for (uint32_t x = 0; x < info.setLayoutCount; x++)
+            {
+                hasher.Add(info.pSetLayouts[x]);
+            }
+            hasher.Add(info.pushConstantRangeCount);
+            for (uint32_t x = 0; x < info.pushConstantRangeCount; x++)
+            {
+                auto& range = info.pPushConstantRanges[x];
+                hasher.Add(range.stageFlags).Add(range.offset).Add(range.size);
+            }
+            auto key = hasher.Key();
+
+            std::lock_guard lock(mutex);
+            auto& layout = pipeline_layouts[key];
+            if (!layout)
+            {
+                layout = device.createPipelineLayout(info);
+                layout_sets[static_cast<VkPipelineLayout>(layout)] = std::vector<vk::DescriptorSetLayout>(info.pSetLayouts, info.pSetLayouts + info.setLayoutCount);
+            }
+            return layout;
+        }
+
+        // Merges the interfaces of all stages: bindings are combined per (set, binding) and all push constants share one range.
+        vk::PipelineLayout GetPipelineLayout(const std::vector<std::shared_ptr<ShaderModule>>& modules, vk::PipelineLayoutCreateFlags flags = {})
+        {
+            std::map<uint32_t, std::map<uint32_t, vk::DescriptorSetLayoutBinding>> sets;
+            std::optional<vk::PushConstantRange> push;
+
+            for (auto& module : modules)
+            {
+                auto& reflection = module->Reflection();
+                for (auto& b : reflection.bindings)
+                {
+                    auto& binding = sets[b.set][b.binding];
+                    if (binding.stageFlags && binding.descriptorType != b.type)
+                    {
+                        throw(std::exception("Shader stages disagree on a descriptor type"));
+                    }
+                    binding
+                        .setBinding(b.binding)
+                        .setDescriptorType(b.type)
+                        .setDescriptorCount(std::max(binding.descriptorCount, b.count))
+                        .setStageFlags(binding.stageFlags | reflection.stage);
+                }
+                if (reflection.push_constant_size > 0)
+                {
+                    if (!push)
+                    {
+                        push = vk::PushConstantRange(reflection.stage, reflection.push_constant_offset, reflection.push_constant_size);
+                        continue;
+                    }
+                    auto end = std::max(push->offset + push->size, reflection.push_constant_offset + reflection.push_constant_size);
+                    push->offset = std::min(push->offset, reflection.push_constant_offset);
+                    push->size = end - push->offset;
+                    push->stageFlags |= reflection.stage;
+                }
+            }
+
+            std::vector<vk::DescriptorSetLayout> layouts;
+            auto count = sets.empty() ? 0 : sets.rbegin()->first + 1;
+            for (uint32_t set = 0; set < count; set++)
+            {
+                std::vector<vk::DescriptorSetLayoutBinding> bindings;
+                for (auto& [index, binding] : sets[set])
+                {
+                    bindings.push_back(binding);
+                }
+                layouts.push_back(GetSetLayout(bindings));
+            }
+
+            auto info = vk::PipelineLayoutCreateInfo()
+                .setFlags(flags)
+                .setSetLayouts(layouts);
+            if (push)
+            {
+                info.setPushConstantRanges(*push);
+            }
+            return GetPipelineLayout(info);
+        }
+
+        std::vector<vk::DescriptorSetLayout> GetSetLayouts(vk::PipelineLayout layout)
+        {
+            std::lock_guard lock(mutex);
+            return layout_sets.at(static_cast<VkPipelineLayout>(layout));
+        }
+    };
+};
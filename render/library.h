@@ -0,0 +1,68 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "vulkan/vulkan.hpp"
+#include "hash.h"
+
+namespace inner
+{
+    // Graphics pipeline library parts (vertex input, pre-rasterization, fragment shader, fragment output) keyed by
+    // the state each one covers. Parts are shared by every pipeline linked from them and live until the device goes.
+    class PipelineLibraryCache
+    {
+        private:
+        vk::Device device;
+        std::mutex mutex;
+        std::unordered_map<HashKey, vk::Pipeline> libraries;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        public:
+        PipelineLibraryCache(vk::Device device):
+        device(device)
+        {}
+
+        ~PipelineLibraryCache()
+        {
+            for (auto& [key, library] : libraries)
+            {
+                device.destroyPipeline(library);
+            }
+        }
+
+        // Creation happens outside the lock, a part created twice by racing threads is destroyed again.
+        vk::Pipeline GetOrCreate(const HashKey& key, const std::function<vk::Pipeline()>& create)
+        {
+            {
+                std::lock_guard lock(mutex);
+                auto entry = libraries.find(key);
+                if (entry != libraries.end())
+                {
+                    hits++;
+                    return entry->second;
+                }
+            }
+            auto created = create();
+
+            std::lock_guard lock(mutex);
+            auto [entry, inserted] = libraries.emplace(key, created);
+            if (!inserted)
+            {
+                device.destroyPipeline(created);
+                hits++;
+                return entry->second;
+            }
+            misses++;
+            return created;
+        }
+
+        auto GetStats()
+        {
+            std::lock_guard lock(mutex);
+            return std::pair(hits, misses);
+        }
+    };
+};
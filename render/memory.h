@@ -0,0 +1,258 @@
+#pragma once
+
+#include "device.h"
+
+namespace inner
+{
+    class Buffer : public vk::Buffer
+    {
+        private:
+        std::shared_ptr<Device> device;
+        Allocation allocation;
+        vk::DeviceSize size;
+        public:
+        Buffer(vk::Buffer buffer, std::shared_ptr<Device> device, Allocation allocation, vk::DeviceSize size):
+        vk::Buffer(buffer), device(device), allocation(allocation), size(size)
+        {}
+
+        ~Buffer()
+        {
+            vk::Device handle = *device;
+            vk::Buffer buffer = *this;
+            auto allocator = &device->GetAllocator();
+            device->GetDeletionQueue().Push([handle, buffer, allocator, allocation = allocation]() {
+                handle.destroyBuffer(buffer);
+                allocator->Free(allocation);
+            });
+        }
+
+        auto Size()
+        {
+            return size;
+        }
+
+        // nullptr unless the buffer lives in host visible memory.
+        auto Mapped()
+        {
+            return allocation.mapped;
+        }
+
+        const Allocation& Memory()
+        {
+            return allocation;
+        }
+    };
+
+    class Image : public vk::Image
+    {
+        private:
+        std::shared_ptr<Device> device;
+        Allocation allocation;
+        vk::Extent3D extent;
+        vk::Format format;
+        uint32_t mip_levels;
+        uint32_t array_layers;
+        public:
+        Image(vk::Image image, std::shared_ptr<Device> device, Allocation allocation, vk::Extent3D extent, vk::Format format, uint32_t mip_levels, uint32_t array_layers):
+        vk::Image(image), device(device), allocation(allocation), extent(extent), format(format), mip_levels(mip_levels), array_layers(array_layers)
+        {}
+
+        ~Image()
+        {
+            vk::Device handle = *device;
+            vk::Image image = *this;
+            auto allocator = &device->GetAllocator();
+            device->GetDeletionQueue().Push([handle, image, allocator, allocation = allocation]() {
+                handle.destroyImage(image);
+                allocator->Free(allocation);
+            });
+        }
+
+        auto Extent()
+        {
+            return extent;
+        }
+
+        auto Format()
+        {
+            return format;
+        }
+
+        auto MipLevels()
+        {
+            return mip_levels;
+        }
+
+        auto ArrayLayers()
+        {
+            return array_layers;
+        }
+
+        const Allocation& Memory()
+        {
+            return allocation;
+        }
+    };
+};
+
+using Buffer = std::shared_ptr<inner::Buffer>;
+using Image = std::shared_ptr<inner::Image>;
+
+class BufferBuilder
+{
+    private:
+    vk::DeviceSize m_Size = 0;
+    vk::BufferUsageFlags m_Usage;
+    MemoryUsage m_Memory = MemoryUsage::GPU_ONLY;
+    std::vector<uint32_t> m_Families;
+    public:
+    auto SetSize(vk::DeviceSize size)
+    {
+        m_Size = size;
+        return *this;
+    }
+
+    auto SetUsage(vk::BufferUsageFlags usage)
+    {
+        m_Usage = usage;
+        return *this;
+    }
+
+    auto SetMemoryUsage(MemoryUsage memory)
+    {
+        m_Memory = memory;
+        return *this;
+    }
+
+    // Shares the buffer between the queues' families instead of transferring ownership between them.
+    auto SetConcurrent(std::vector<Queue> queues)
+    {
+        m_Families.clear();
+        for (auto& queue : queues)
+        {
+            if (std::find(m_Families.begin(), m_Families.end(), queue.Family()) == m_Families.end())
+                m_Families.push_back(queue.Family());
+        }
+        return *this;
+    }
+
+    auto Build(Device device)
+    {
+        auto info = vk::BufferCreateInfo()
+            .setSize(m_Size)
+            .setUsage(m_Usage)
+            .setSharingMode(vk::SharingMode::eExclusive);
+        if (m_Families.size() > 1)
+        {
+            info.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_Families);
+        }
+        auto buffer = device->createBuffer(info);
+
+        auto requirements = device->getBufferMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::BufferMemoryRequirementsInfo2().setBuffer(buffer));
+        auto& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+        auto allocation = device->GetAllocator().Allocate(
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements, m_Memory, true,
+            dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation, buffer);
+        device->bindBufferMemory(buffer, allocation.memory, allocation.offset);
+
+        return std::make_shared<inner::Buffer>(buffer, device, allocation, m_Size);
+    }
+};
+
+class ImageBuilder
+{
+    private:
+    vk::Extent3D m_Extent = vk::Extent3D(1, 1, 1);
+    vk::Format m_Format = vk::Format::eR8G8B8A8Unorm;
+    vk::ImageUsageFlags m_Usage;
+    vk::ImageType m_Type = vk::ImageType::e2D;
+    vk::ImageTiling m_Tiling = vk::ImageTiling::eOptimal;
+    vk::SampleCountFlagBits m_Samples = vk::SampleCountFlagBits::e1;
+    uint32_t m_MipLevels = 1;
+    uint32_t m_ArrayLayers = 1;
+    MemoryUsage m_Memory = MemoryUsage::GPU_ONLY;
+    public:
+    auto SetExtent(vk::Extent2D extent)
+    {
+        m_Extent = vk::Extent3D(extent, 1);
+        m_Type = vk::ImageType::e2D;
+        return *this;
+    }
+
+    auto SetExtent(vk::Extent3D extent)
+    {
+        m_Extent = extent;
+        m_Type = extent.depth > 1 ? vk::ImageType::e3D : vk::ImageType::e2D;
+        return *this;
+    }
+
+    auto SetFormat(vk::Format format)
+    {
+        m_Format = format;
+        return *this;
+    }
+
+    auto SetUsage(vk::ImageUsageFlags usage)
+    {
+        m_Usage = usage;
+        return *this;
+    }
+
+    auto SetTiling(vk::ImageTiling tiling)
+    {
+        m_Tiling = tiling;
+        return *this;
+    }
+
+    auto SetSamples(vk::SampleCountFlagBits samples)
+    {
+        m_Samples = samples;
+        return *this;
+    }
+
+    auto SetMipLevels(uint32_t levels)
+    {
+        m_MipLevels = levels;
+        return *this;
+    }
+
+    auto SetArrayLayers(uint32_t layers)
+    {
+        m_ArrayLayers = layers;
+        return *this;
+    }
+
+    auto SetMemoryUsage(MemoryUsage memory)
+    {
+        m_Memory = memory;
+        return *this;
+    }
+
+    auto Build(Device device)
+    {
+        auto image = device->createImage(
+            vk::ImageCreateInfo()
+                .setImageType(m_Type)
+                .setExtent(m_Extent)
+                .setFormat(m_Format)
+                .setUsage(m_Usage)
+                .setTiling(m_Tiling)
+                .setSamples(m_Samples)
+                .setMipLevels(m_MipLevels)
+                .setArrayLayers(m_ArrayLayers)
+                .setSharingMode(vk::SharingMode::eExclusive)
+                .setInitialLayout(vk::ImageLayout::eUndefined)
+        );
+
+        auto requirements = device->getImageMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::ImageMemoryRequirementsInfo2().setImage(image));
+        auto& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+        auto allocation = device->GetAllocator().Allocate(
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements, m_Memory, m_Tiling == vk::ImageTiling::eLinear,
+            dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation, {}, image);
+        device->bindImageMemory(image, allocation.memory, allocation.offset);
+
+        return std::make_shared<inner::Image>(image, device, allocation, m_Extent, m_Format, m_MipLevels, m_ArrayLayers);
+    }
+};
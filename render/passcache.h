@@ -0,0 +1,191 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "pool.h"
+#include "renderpass.h"
+
+namespace inner
+{
+    // Render passes keyed by RenderpassBuilder::Key. Entries are held until Clear, so a pass that is described
+    // again every frame or after every resize gets the same vk::RenderPass back, and pipelines built against it
+    // keep matching. Configurations are few, nothing is evicted on its own.
+    class RenderpassCache
+    {
+        private:
+        std::shared_ptr<Device> device;
+        std::mutex mutex;
+        std::unordered_map<HashKey, std::shared_ptr<Renderpass>> renderpasses;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        public:
+        RenderpassCache(std::shared_ptr<Device> device):
+        device(device)
+        {}
+
+        std::shared_ptr<Renderpass> Get(RenderpassBuilder builder)
+        {
+            auto key = builder.Key();
+            std::lock_guard lock(mutex);
+            auto& renderpass = renderpasses[key];
+            if (renderpass)
+            {
+                hits++;
+                return renderpass;
+            }
+            misses++;
+            renderpass = builder.Build(device);
+            return renderpass;
+        }
+
+        // Render passes still referenced elsewhere stay alive, the rest retire through the deletion queue.
+        void Clear()
+        {
+            std::lock_guard lock(mutex);
+            renderpasses.clear();
+        }
+
+        auto Size()
+        {
+            std::lock_guard lock(mutex);
+            return renderpasses.size();
+        }
+
+        auto GetStats()
+        {
+            std::lock_guard lock(mutex);
+            return std::pair(hits, misses);
+        }
+    };
+
+    // Framebuffers keyed by render pass, attachment views and extent. A framebuffer is only valid while its views
+    // are, so whoever destroys views has to Evict them first, the evicted framebuffers then retire through the
+    // deletion queue behind any frame still using them.
+    class FramebufferCache
+    {
+        private:
+        struct Entry
+        {
+            std::shared_ptr<Framebuffer> framebuffer;
+            std::vector<vk::ImageView> views;
+        };
+
+        std::shared_ptr<Device> device;
+        std::mutex mutex;
+        std::unordered_map<HashKey, Entry> framebuffers;
+        std::unordered_map<VkImageView, std::vector<HashKey>> by_view;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        void Erase(const HashKey& key)
+        {
+            auto entry = framebuffers.find(key);
+            if (entry == framebuffers.end())
+                return;
+            for (auto view : entry->second.views)
+            {
+                auto keys = by_view.find(static_cast<VkImageView>(view));
+                if (keys == by_view.end())
+                    continue;
+                std::erase(keys->second, key);
+                if (keys->second.empty())
+                    by_view.erase(keys);
+            }
+            framebuffers.erase(entry);
+        }
+
+        public:
+        FramebufferCache(std::shared_ptr<Device> device):
+        device(device)
+        {}
+
+        std::shared_ptr<Framebuffer> Get(FramebufferBuilder builder, vk::Extent2D size, std::shared_ptr<Renderpass> renderpass)
+        {
+            auto& views = builder.Attachments();
+            auto key = Hasher()
+                .Add(static_cast<vk::RenderPass>(*renderpass))
+                .Add(views)
+                .Add(size.width)
+                .Add(size.height)
+                .Key();
+
+            std::lock_guard lock(mutex);
+            auto& entry = framebuffers[key];
+            if (entry.framebuffer)
+            {
+                hits++;
+                return entry.framebuffer;
+            }
+            misses++;
+            entry.framebuffer = builder.Build(device, size, renderpass);
+            entry.views = views;
+            for (auto view : views)
+            {
+                by_view[static_cast<VkImageView>(view)].push_back(key);
+            }
+            return entry.framebuffer;
+        }
+
+        // Drops every framebuffer that uses one of views.
+        void Evict(const std::vector<vk::ImageView>& views)
+        {
+            std::lock_guard lock(mutex);
+            for (auto view : views)
+            {
+                auto keys = by_view.find(static_cast<VkImageView>(view));
+                if (keys == by_view.end())
+                    continue;
+                // Erase updates the list being walked.
+                auto evicted = keys->second;
+                for (auto& key : evicted)
+                {
+                    Erase(key);
+                }
+            }
+        }
+
+        void Clear()
+        {
+            std::lock_guard lock(mutex);
+            framebuffers.clear();
+            by_view.clear();
+        }
+
+        auto Size()
+        {
+            std::lock_guard lock(mutex);
+            return framebuffers.size();
+        }
+
+        auto GetStats()
+        {
+            std::lock_guard lock(mutex);
+            return std::pair(hits, misses);
+        }
+    };
+};
+
+using RenderpassCache = std::shared_ptr<inner::RenderpassCache>;
+using FramebufferCache = std::shared_ptr<inner::FramebufferCache>;
+
+class RenderpassCacheBuilder
+{
+    public:
+    auto Build(Device device)
+    {
+        return std::make_shared<inner::RenderpassCache>(device);
+    }
+};
+
+class FramebufferCacheBuilder
+{
+    public:
+    auto Build(Device device)
+    {
+        return std::make_shared<inner::FramebufferCache>(device);
+    }
+};
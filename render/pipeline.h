@@ -1,35 +1,87 @@
 #pragma once
 
 
-#include <fstream>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "renderpass.h"
+#include "shader.h"
+#include "vertex.h"
+#include "state.h"
+#include "worker.h"
 
 
 
 namespace inner
 {
-	class Pipeline : public vk::Pipeline
+	// The base only holds the handle the pipeline was created with, it is private so binds have to go through Handle().
+	class Pipeline : private vk::Pipeline
 	{
 		private:
 		std::shared_ptr<Device> device;
 		std::shared_ptr<Renderpass> renderpass;
 		vk::PipelineLayout layout;
 		vk::PipelineBindPoint _bind;
+		std::atomic<VkPipeline> handle;
+		std::vector<vk::Pipeline> retired;
+
+		bool dynamic = false;
+		bool extended = false;
+		bool extended2 = false;
+		DynamicState defaults;
+		std::function<std::shared_ptr<Pipeline>(const DynamicState&)> permute;
+		std::mutex mutex;
+		// Only a handful of states per pipeline, a scan comparing the baked groups beats hashing them on every flush.
+		std::shared_mutex permutations_mutex;
+		std::vector<std::pair<DynamicState, std::shared_ptr<Pipeline>>> permutations;
+
+		// A stored nullptr means the state matches this pipeline, so a miss is told apart by the returned pointer.
+		const std::shared_ptr<Pipeline>* FindPermutation(const DynamicState& state)
+		{
+			for (auto& [key, pipeline] : permutations)
+			{
+				if (key.Matches(state, !extended, !extended2))
+					return &pipeline;
+			}
+			return nullptr;
+		}
+
 		public:
 		Pipeline(vk::PipelineLayout layout, vk::Pipeline pipeline, vk::PipelineBindPoint bind, std::shared_ptr<Device> device, std::shared_ptr<Renderpass> renderpass):
-		layout(layout), vk::Pipeline(pipeline), _bind(bind), device(device), renderpass(renderpass)
+		layout(layout), vk::Pipeline(pipeline), _bind(bind), device(device), renderpass(renderpass), handle(pipeline)
 		{}
 
 		Pipeline(vk::PipelineLayout layout, vk::Pipeline pipeline, vk::PipelineBindPoint bind, std::shared_ptr<inner::Device> device):
-		layout(layout), vk::Pipeline(pipeline), _bind(bind), device(device)
+		layout(layout), vk::Pipeline(pipeline), _bind(bind), device(device), handle(pipeline)
 		{}
 
 		~Pipeline()
 		{
-			device->destroyPipeline(*this);
-			device->destroyPipelineLayout(layout);
+			device->Retire(Handle());
+			for (auto pipeline : retired)
+			{
+				device->Retire(pipeline);
+			}
+		}
+
+		// The handle to bind. Starts out as the handle the pipeline was created with and changes once when a
+		// fast-linked pipeline is replaced by its optimized build.
+		vk::Pipeline Handle()
+		{
+			return handle.load(std::memory_order_acquire);
+		}
+
+		// Command buffers recorded with the previous handle may still be in flight, so it is only destroyed with the pipeline.
+		void Replace(vk::Pipeline pipeline)
+		{
+			auto previous = handle.exchange(pipeline, std::memory_order_acq_rel);
+			std::lock_guard lock(mutex);
+			retired.push_back(previous);
 		}
 
 		auto bind()
@@ -37,6 +89,70 @@ namespace inner
 			return _bind;
 		}
 
+		// Owned by the device's LayoutCache and shared by every pipeline with the same interface.
+		auto Layout()
+		{
+			return layout;
+		}
+
+		// extended and extended2 tell which DynamicState groups the pipeline leaves dynamic, permute builds a
+		// pipeline with the remaining groups baked in.
+		void SetDynamicState(bool extended, bool extended2, DynamicState defaults, std::function<std::shared_ptr<Pipeline>(const DynamicState&)> permute)
+		{
+			this->dynamic = true;
+			this->extended = extended;
+			this->extended2 = extended2;
+			this->defaults = defaults;
+			if (!extended || !extended2)
+				this->permute = permute;
+		}
+
+		auto IsDynamic()
+		{
+			return dynamic;
+		}
+
+		auto IsExtended()
+		{
+			return extended;
+		}
+
+		auto IsExtended2()
+		{
+			return extended2;
+		}
+
+		// The state the pipeline was built with, used for anything the command buffer has not set.
+		const DynamicState& Defaults()
+		{
+			return defaults;
+		}
+
+		// Returns nullptr when this pipeline itself matches the state. Permutations live as long as this pipeline,
+		// so the raw pointer is what command buffers keep while recording.
+		Pipeline* Permutation(const DynamicState& state)
+		{
+			if (!permute)
+				return nullptr;
+
+			{
+				std::shared_lock lock(permutations_mutex);
+				if (auto found = FindPermutation(state))
+					return found->get();
+			}
+
+			std::unique_lock lock(permutations_mutex);
+			if (auto found = FindPermutation(state))
+				return found->get();
+
+			auto pipeline = permute(state);
+			// The registry hands back this pipeline when the state equals the baked one, which must not be stored.
+			if (pipeline.get() == this)
+				pipeline = nullptr;
+			permutations.emplace_back(state, pipeline);
+			return pipeline.get();
+		}
+
 	};
 
 };
@@ -56,9 +172,15 @@ class GraphicsPipelineBuilder
 	std::vector<vk::VertexInputBindingDescription> m_VertexBindings;
 	std::vector<vk::VertexInputAttributeDescription> m_VertexAttributes;
 	std::vector<vk::PipelineShaderStageCreateInfo> m_ShaderStages;
-	std::vector<vk::ShaderModule> m_ShaderModules;
+	std::vector<ShaderModule> m_ShaderModules;
 	vk::PipelineLayout m_Layout;
-	vk::PipelineBindPoint m_Bind;
+	vk::PipelineBindPoint m_Bind = vk::PipelineBindPoint::eGraphics;
+	std::optional<uint32_t> m_Subpass;
+	GraphicsPipelineState m_State;
+	std::vector<std::pair<vk::ShaderStageFlags, SpecializationConstants>> m_Specialization;
+	bool m_Dynamic = false;
+	bool m_Permutation = false;
+	WorkerPool m_LinkWorkers;
 	Device device;
 	public:
 	GraphicsPipelineBuilder(Device device):
@@ -67,106 +189,67 @@ class GraphicsPipelineBuilder
 	
 	auto AddVertexInput(std::vector<VertexInput> input, vk::VertexInputRate rate)
 	{
-		uint32_t c = 0;
+		auto binding = static_cast<uint32_t>(m_VertexBindings.size());
+		uint32_t offset = 0;
 		for (auto t : input)
 		{
 			vk::Format format;
+			uint32_t size;
 			switch (t)
 			{
 			case VEC2:
-				format = vk::Format::eR32G32Sfloat; break;
+				format = vk::Format::eR32G32Sfloat; size = sizeof(float) * 2; break;
 			case VEC4:
-				format = vk::Format::eR32G32B32A32Sfloat; break;
+				format = vk::Format::eR32G32B32A32Sfloat; size = sizeof(float) * 4; break;
 			case VEC3:
-				format = vk::Format::eR32G32B32Sfloat; break;
+				format = vk::Format::eR32G32B32Sfloat; size = sizeof(float) * 3; break;
 			case FLOAT:
-				format = vk::Format::eR32Sfloat; break;
+				format = vk::Format::eR32Sfloat; size = sizeof(float); break;
 			case INT:
-				format = vk::Format::eR32Sint; break;
+				format = vk::Format::eR32Sint; size = sizeof(int32_t); break;
 			default:
 				throw(std::exception("Unsupported format!"));
 				return std::move(*this);
 
-			}
-			uint32_t offset = 0;
-			for (uint32_t x = 0; x < c; x++)
-			{
-				switch (input[x])
-				{
-				case VEC2:
-					offset += sizeof(float) * 2; break;
-				case VEC4:
-					offset += sizeof(float) * 4; break;
-				case VEC3:
-					offset += sizeof(float) * 3; break;
-				case FLOAT:
-					offset += sizeof(float); break;
-				case INT:
-					offset += sizeof(int32_t); break;
-				}
-
 			}
 			m_VertexAttributes.emplace_back(
 				vk::VertexInputAttributeDescription()
-					.setBinding(static_cast<uint32_t>(m_VertexBindings.size()))
-					.setLocation(c)
+					.setBinding(binding)
+					.setLocation(static_cast<uint32_t>(m_VertexAttributes.size()))
 					.setFormat(format)
 					.setOffset(offset)
 			);
-			c++;
-		}
-		uint32_t offset = 0;
-		for (auto t : input)
-		{
-			switch (t)
-			{
-				case VEC2:
-					offset += sizeof(float) * 2; break;
-				case VEC4:
-					offset += sizeof(float) * 4; break;
-				case VEC3:
-					offset += sizeof(float) * 3; break;
-				case FLOAT:
-					offset += sizeof(float); break;
-				case INT:
-					offset += sizeof(int32_t); break;
-			}
+			offset += size;
 		}
 
 		m_VertexBindings.emplace_back(
 			vk::VertexInputBindingDescription()
-				.setBinding(static_cast<uint32_t>(m_VertexBindings.size()))
+				.setBinding(binding)
 				.setStride(offset)
 				.setInputRate(rate)
 		);
 		return std::move(*this);
 	}
-	
-	auto AddShaderFromFile(const std::string path, vk::ShaderStageFlagBits stage, const char* entry_point = "main")
-	{
-		std::vector<char> bytes;
 
-		auto file = std::ifstream(path, std::ios::ate | std::ios::binary);
-		if (!file)
-			throw(std::exception(("File not found: " + path + ".").data()));
-		if (file.is_open())
+	// Offsets, stride and formats come from a VertexLayout and are computed at compile time.
+	template <typename Layout>
+	auto AddVertexInput(vk::VertexInputRate rate = vk::VertexInputRate::eVertex)
+	{
+		auto binding = static_cast<uint32_t>(m_VertexBindings.size());
+		for (auto& attribute : Layout::Attributes(binding, static_cast<uint32_t>(m_VertexAttributes.size())))
 		{
-			size_t fileSize = (size_t)file.tellg();
-			bytes.resize(fileSize);
-			file.seekg(0);
-			file.read(bytes.data(), fileSize);
-			file.close();
+			m_VertexAttributes.push_back(attribute);
 		}
-		m_ShaderModules.emplace_back(
-			device->createShaderModule(
-				vk::ShaderModuleCreateInfo()
-					.setCodeSize(bytes.size())
-					.setPCode((uint32_t*)bytes.data())
-			)
-		);
+		m_VertexBindings.push_back(Layout::Binding(binding, rate));
+		return std::move(*this);
+	}
+	
+	auto AddShaderFromFile(const std::string path, vk::ShaderStageFlagBits stage, const char* entry_point = "main")
+	{
+		m_ShaderModules.emplace_back(device->GetShaderCache().Get(path));
 		m_ShaderStages.emplace_back(
 			vk::PipelineShaderStageCreateInfo()
-			.setModule(m_ShaderModules.at(m_ShaderModules.size() - 1))
+			.setModule(*m_ShaderModules.at(m_ShaderModules.size() - 1))
 			.setStage(stage)
 			.setPName(entry_point)
 		);
@@ -186,7 +269,37 @@ class GraphicsPipelineBuilder
 
 	auto AddPipelineLayout(vk::PipelineLayoutCreateInfo info)
 	{
-		m_Layout = device->createPipelineLayout(info);
+		m_Layout = device->GetLayoutCache().GetPipelineLayout(info);
+		return std::move(*this);
+	}
+
+	// Derives a single interleaved binding from the vertex shader's input locations.
+	auto AddReflectedVertexInput(vk::VertexInputRate rate = vk::VertexInputRate::eVertex)
+	{
+		auto binding = static_cast<uint32_t>(m_VertexBindings.size());
+		uint32_t offset = 0;
+		for (auto& module : m_ShaderModules)
+		{
+			if (!(module->Reflection().stage & vk::ShaderStageFlagBits::eVertex))
+				continue;
+			for (auto& input : module->Reflection().inputs)
+			{
+				m_VertexAttributes.emplace_back(
+					vk::VertexInputAttributeDescription()
+						.setBinding(binding)
+						.setLocation(input.location)
+						.setFormat(input.format)
+						.setOffset(offset)
+				);
+				offset += input.size;
+			}
+		}
+		m_VertexBindings.emplace_back(
+			vk::VertexInputBindingDescription()
+				.setBinding(binding)
+				.setStride(offset)
+				.setInputRate(rate)
+		);
 		return std::move(*this);
 	}
 
@@ -195,62 +308,202 @@ class GraphicsPipelineBuilder
 		m_ShaderStages.push_back(info);
 		return std::move(*this);
 	}
+
+	// Defaults to subpass 0.
+	auto SetSubpass(uint32_t subpass)
+	{
+		m_Subpass = subpass;
+		return std::move(*this);
+	}
+
+	auto SetState(GraphicsPipelineState state)
+	{
+		m_State = state;
+		return std::move(*this);
+	}
+
+	// Leaves cull mode, front face, topology, depth/stencil test and the DynamicState toggles to the command buffer.
+	auto SetDynamicState(bool dynamic = true)
+	{
+		m_Dynamic = dynamic;
+		return std::move(*this);
+	}
+
+	// With graphics pipeline libraries, Build returns a fast-linked pipeline and links the optimized one on these
+	// workers. Without workers the optimized link happens in Build. Devices without the extension ignore this.
+	auto SetLinkWorkers(WorkerPool workers)
+	{
+		m_LinkWorkers = workers;
+		return std::move(*this);
+	}
+
+	// Applies to every listed stage, a later call for the same stage replaces the earlier constants.
+	auto SetSpecialization(vk::ShaderStageFlags stages, SpecializationConstants constants)
+	{
+		m_Specialization.emplace_back(stages, constants);
+		return std::move(*this);
+	}
+
 	auto Build(Renderpass renderpass, uint32_t colorblend_count)
+	{
+		if (!m_Layout)
+			m_Layout = device->GetLayoutCache().GetPipelineLayout(m_ShaderModules);
+
+		auto subpass = m_Subpass.value_or(0);
+		return device->GetPipelineRegistry().GetOrCreate(Key(renderpass, colorblend_count, subpass), [&] {
+			return Create(renderpass, colorblend_count, subpass);
+		});
+	}
+
+	private:
+	const SpecializationConstants* Specialization(vk::ShaderStageFlagBits stage)
+	{
+		for (auto entry = m_Specialization.rbegin(); entry != m_Specialization.rend(); entry++)
+		{
+			if (entry->first & stage)
+				return &entry->second;
+		}
+		return nullptr;
+	}
+
+	void HashStage(Hasher& hasher, const vk::PipelineShaderStageCreateInfo& stage)
+	{
+		hasher.Add(stage.stage).Add(std::string(stage.pName));
+		auto module = std::find_if(m_ShaderModules.begin(), m_ShaderModules.end(), [&](auto& m) {
+			return static_cast<vk::ShaderModule>(*m) == stage.module;
+		});
+		hasher.Add(module != m_ShaderModules.end());
+		if (module != m_ShaderModules.end())
+			hasher.Add((*module)->Digest());
+		else
+			hasher.Add(stage.module);
+
+		auto constants = Specialization(stage.stage);
+		hasher.Add(constants != nullptr);
+		if (constants)
+			constants->Hash(hasher);
+	}
+
+	void HashVertexInput(Hasher& hasher)
+	{
+		hasher.Add(m_VertexBindings.size());
+		for (auto& binding : m_VertexBindings)
+		{
+			hasher.Add(binding.binding).Add(binding.stride).Add(binding.inputRate);
+		}
+		hasher.Add(m_VertexAttributes.size());
+		for (auto& attribute : m_VertexAttributes)
+		{
+			hasher.Add(attribute.location).Add(attribute.binding).Add(attribute.format).Add(attribute.offset);
+		}
+	}
+
+	// Shaders are identified by the SHA-256 of their SPIR-V where known, so neither a recycled module handle nor two
+	// modules with colliding 64-bit hashes can alias an old pipeline.
+	HashKey Key(Renderpass renderpass, uint32_t colorblend_count, uint32_t subpass)
+	{
+		Hasher hasher;
+		hasher.Add(m_ShaderStages.size());
+		for (auto& stage : m_ShaderStages)
+		{
+			HashStage(hasher, stage);
+		}
+		HashVertexInput(hasher);
+		m_State.Hash(hasher, colorblend_count);
+		// A permutation bakes in what the dynamic pipeline with the same state leaves to the command buffer.
+		hasher.Add(m_Dynamic).Add(m_Permutation);
+		hasher.Add(m_Layout).Add(static_cast<vk::RenderPass>(*renderpass)).Add(subpass);
+		return hasher.Key();
+	}
+
+	Pipeline Create(Renderpass renderpass, uint32_t colorblend_count, uint32_t subpass)
 	{
 		auto depth = vk::PipelineDepthStencilStateCreateInfo()
-			.setDepthTestEnable(false)
-			.setDepthWriteEnable(false)
-			.setDepthCompareOp(vk::CompareOp::eGreater)
-			.setFront(vk::StencilOpState().setCompareOp(vk::CompareOp::eAlways))
-			.setBack(vk::StencilOpState().setCompareOp(vk::CompareOp::eAlways));
+			.setDepthTestEnable(m_State.depth_test)
+			.setDepthWriteEnable(m_State.depth_write)
+			.setDepthCompareOp(m_State.depth_compare)
+			.setStencilTestEnable(m_State.stencil_test)
+			.setFront(m_State.stencil_front)
+			.setBack(m_State.stencil_back);
 		auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
-			.setDepthClampEnable(vk::Bool32(false))
-			.setRasterizerDiscardEnable(vk::Bool32(false))
-			.setPolygonMode(vk::PolygonMode::eFill)
-			.setLineWidth(1.0f)
-			.setCullMode(vk::CullModeFlagBits::eBack)
-			.setFrontFace(vk::FrontFace::eClockwise)
-			.setDepthBiasEnable(vk::Bool32(false));
+			.setDepthClampEnable(m_State.depth_clamp)
+			.setRasterizerDiscardEnable(m_State.rasterizer_discard)
+			.setPolygonMode(m_State.polygon_mode)
+			.setLineWidth(m_State.line_width)
+			.setCullMode(m_State.cull_mode)
+			.setFrontFace(m_State.front_face)
+			.setDepthBiasEnable(m_State.depth_bias)
+			.setDepthBiasConstantFactor(m_State.depth_bias_constant)
+			.setDepthBiasClamp(m_State.depth_bias_clamp)
+			.setDepthBiasSlopeFactor(m_State.depth_bias_slope);
 		auto multisample = vk::PipelineMultisampleStateCreateInfo()
-			.setSampleShadingEnable(vk::Bool32(false))
-			.setRasterizationSamples(vk::SampleCountFlagBits::e1);
-		const std::array<vk::DynamicState, 2> dynamicStates =
+			.setSampleShadingEnable(m_State.sample_shading)
+			.setMinSampleShading(m_State.min_sample_shading)
+			.setAlphaToCoverageEnable(m_State.alpha_to_coverage)
+			.setRasterizationSamples(m_State.samples);
+		std::vector<vk::DynamicState> dynamicStates =
 		{
 			vk::DynamicState::eViewport,
 			vk::DynamicState::eScissor,
 		};
+		auto extended = m_Dynamic && device->HasExtendedDynamicState();
+		auto extended2 = m_Dynamic && device->HasExtendedDynamicState2();
+		if (extended)
+		{
+			dynamicStates.insert(dynamicStates.end(), {
+				vk::DynamicState::eCullModeEXT,
+				vk::DynamicState::eFrontFaceEXT,
+				vk::DynamicState::ePrimitiveTopologyEXT,
+				vk::DynamicState::eDepthTestEnableEXT,
+				vk::DynamicState::eDepthWriteEnableEXT,
+				vk::DynamicState::eDepthCompareOpEXT,
+				vk::DynamicState::eStencilTestEnableEXT,
+			});
+		}
+		if (extended2)
+		{
+			dynamicStates.insert(dynamicStates.end(), {
+				vk::DynamicState::eRasterizerDiscardEnableEXT,
+				vk::DynamicState::eDepthBiasEnableEXT,
+				vk::DynamicState::ePrimitiveRestartEnableEXT,
+			});
+		}
 		auto dynamic = vk::PipelineDynamicStateCreateInfo()
 			.setDynamicStates(dynamicStates);
 		auto assembly = vk::PipelineInputAssemblyStateCreateInfo()
-			.setTopology(vk::PrimitiveTopology::eTriangleList)
-			.setPrimitiveRestartEnable(false);
+			.setTopology(m_State.topology)
+			.setPrimitiveRestartEnable(m_State.primitive_restart);
 		auto viewport = vk::PipelineViewportStateCreateInfo()
 			.setViewportCount(1)
 			.setScissorCount(1);
 		std::vector<vk::PipelineColorBlendAttachmentState> blends;
 		for (uint32_t x = 0; x < colorblend_count; x++)
 		{
-			auto s = vk::PipelineColorBlendAttachmentState()
-				.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
-				.setBlendEnable(true)
-				.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
-				.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
-				.setColorBlendOp(vk::BlendOp::eAdd)
-				.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
-				.setDstAlphaBlendFactor(vk::BlendFactor::eZero)
-				.setAlphaBlendOp(vk::BlendOp::eAdd);
-			blends.push_back(s);
+			blends.push_back(m_State.Blend(x).Attachment());
 		}
 		auto blend = vk::PipelineColorBlendStateCreateInfo()
+			.setLogicOpEnable(m_State.logic_op_enable)
+			.setLogicOp(m_State.logic_op)
+			.setBlendConstants(m_State.blend_constants)
 			.setAttachments(blends);
 
 		auto vertexInput = vk::PipelineVertexInputStateCreateInfo()
 			.setVertexBindingDescriptions(m_VertexBindings)
 			.setVertexAttributeDescriptions(m_VertexAttributes);
-		
+
+		auto stages = m_ShaderStages;
+		std::vector<vk::SpecializationInfo> specialization(stages.size());
+		for (size_t x = 0; x < stages.size(); x++)
+		{
+			if (auto constants = Specialization(stages[x].stage))
+			{
+				specialization[x] = constants->Info();
+				stages[x].setPSpecializationInfo(&specialization[x]);
+			}
+		}
 		
 		auto pipelineInfo = vk::GraphicsPipelineCreateInfo()
-			.setStages(m_ShaderStages)
+			.setStages(stages)
 			.setPVertexInputState(&vertexInput)
 			.setPInputAssemblyState(&assembly)
 			.setPViewportState(&viewport)
@@ -260,20 +513,148 @@ class GraphicsPipelineBuilder
 			.setPColorBlendState(&blend)
 			.setPDynamicState(&dynamic)
 			.setLayout(m_Layout)
-			.setSubpass(renderpass->subpass_count)
+			.setSubpass(subpass)
 			.setRenderPass(*renderpass);
 
-		renderpass->subpass_count++;
+		vk::Pipeline pipeline;
+#ifdef VK_EXT_graphics_pipeline_library
+		std::array<vk::Pipeline, 4> libraries;
+		if (device->HasGraphicsPipelineLibrary())
+		{
+			libraries = CreateLibraries(pipelineInfo, renderpass, colorblend_count, subpass);
+			pipeline = Link(device, m_Layout, libraries, !m_LinkWorkers);
+		}
+		else
+#endif
+		pipeline = device->GetPipelineCache().CreateGraphicsPipeline(pipelineInfo);
 
-		auto pipeline = device->createGraphicsPipeline(nullptr, pipelineInfo);
+		auto created = std::make_shared<inner::Pipeline>(m_Layout, pipeline, m_Bind, device, renderpass);
+#ifdef VK_EXT_graphics_pipeline_library
+		if (device->HasGraphicsPipelineLibrary() && m_LinkWorkers)
+		{
+			std::weak_ptr<inner::Pipeline> weak = created;
+			m_LinkWorkers->Submit([weak, device = device, layout = m_Layout, libraries] {
+				auto optimized = Link(device, layout, libraries, true);
+				if (auto pipeline = weak.lock())
+					pipeline->Replace(optimized);
+				else
+					device->destroyPipeline(optimized);
+			});
+		}
+#endif
+		if (m_Dynamic && !m_Permutation)
+		{
+			auto builder = std::make_shared<GraphicsPipelineBuilder>(*this);
+			created->SetDynamicState(extended, extended2, DynamicState::From(m_State), [builder, renderpass, colorblend_count, subpass](const DynamicState& state) {
+				auto permutation = *builder;
+				state.Apply(permutation.m_State);
+				permutation.m_Permutation = true;
+				permutation.m_Subpass = subpass;
+				return permutation.Build(renderpass, colorblend_count);
+			});
+		}
+		return created;
+	}
 
-		for(auto mod : m_ShaderModules)
+#ifdef VK_EXT_graphics_pipeline_library
+	// Splits a complete create info into the four library parts, each looked up in the device's library cache by
+	// the state it covers, so a new material only compiles the parts nobody has built yet.
+	std::array<vk::Pipeline, 4> CreateLibraries(const vk::GraphicsPipelineCreateInfo& info, Renderpass renderpass, uint32_t colorblend_count, uint32_t subpass)
+	{
+		auto part = [&](vk::GraphicsPipelineLibraryFlagBitsEXT flag, const HashKey& key, vk::GraphicsPipelineCreateInfo part_info) {
+			return device->GetLibraryCache().GetOrCreate(key, [&] {
+				auto library = vk::GraphicsPipelineLibraryCreateInfoEXT().setFlags(flag);
+				part_info
+					.setPNext(&library)
+					.setFlags(vk::PipelineCreateFlagBits::eLibraryKHR | vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT);
+				return device->GetPipelineCache().CreateGraphicsPipeline(part_info);
+			});
+		};
+		// Parts outlive the render passes they were built against, so the pass is identified by its description. Layouts
+		// come from the LayoutCache and live as long as the device, their handles are never reused.
+		auto key = [&](vk::GraphicsPipelineLibraryFlagBitsEXT flag) {
+			Hasher hasher;
+			hasher.Add(flag).Add(m_Dynamic);
+			if (flag != vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface)
+				hasher.Add(renderpass->Key()).Add(subpass);
+			return hasher;
+		};
+
+		std::vector<vk::PipelineShaderStageCreateInfo> pre_rasterization;
+		std::vector<vk::PipelineShaderStageCreateInfo> fragment;
+		for (uint32_t x = 0; x < info.stageCount; x++)
 		{
-			device->destroyShaderModule(mod);
+			auto& stage = info.pStages[x];
+			(stage.stage == vk::ShaderStageFlagBits::eFragment ? fragment : pre_rasterization).push_back(stage);
 		}
 
-		return std::make_shared<inner::Pipeline>(m_Layout, pipeline, m_Bind, device, renderpass);
+		auto vertex_key = key(vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface);
+		HashVertexInput(vertex_key);
+		m_State.HashVertexInput(vertex_key);
+
+		auto pre_rasterization_key = key(vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders);
+		for (auto& stage : pre_rasterization)
+			HashStage(pre_rasterization_key, stage);
+		m_State.HashPreRasterization(pre_rasterization_key);
+		pre_rasterization_key.Add(m_Layout);
+
+		auto fragment_key = key(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader);
+		for (auto& stage : fragment)
+			HashStage(fragment_key, stage);
+		m_State.HashFragmentShader(fragment_key);
+		fragment_key.Add(m_Layout);
+
+		auto output_key = key(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface);
+		m_State.HashFragmentOutput(output_key, colorblend_count);
+
+		return {
+			part(vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface, vertex_key.Key(),
+				vk::GraphicsPipelineCreateInfo()
+				.setPVertexInputState(info.pVertexInputState)
+				.setPInputAssemblyState(info.pInputAssemblyState)
+				.setPDynamicState(info.pDynamicState)),
+			part(vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders, pre_rasterization_key.Key(),
+				vk::GraphicsPipelineCreateInfo()
+				.setStages(pre_rasterization)
+				.setPViewportState(info.pViewportState)
+				.setPRasterizationState(info.pRasterizationState)
+				.setPDynamicState(info.pDynamicState)
+				.setLayout(info.layout)
+				.setRenderPass(info.renderPass)
+				.setSubpass(info.subpass)),
+			part(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader, fragment_key.Key(),
+				vk::GraphicsPipelineCreateInfo()
+				.setStages(fragment)
+				.setPDepthStencilState(info.pDepthStencilState)
+				.setPMultisampleState(info.pMultisampleState)
+				.setPDynamicState(info.pDynamicState)
+				.setLayout(info.layout)
+				.setRenderPass(info.renderPass)
+				.setSubpass(info.subpass)),
+			part(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface, output_key.Key(),
+				vk::GraphicsPipelineCreateInfo()
+				.setPColorBlendState(info.pColorBlendState)
+				.setPMultisampleState(info.pMultisampleState)
+				.setPDynamicState(info.pDynamicState)
+				.setRenderPass(info.renderPass)
+				.setSubpass(info.subpass)),
+		};
+	}
+
+	// A plain link is cheap and good enough to draw with right away, the link time optimized one is what the driver
+	// would have produced from a monolithic create.
+	static vk::Pipeline Link(Device device, vk::PipelineLayout layout, const std::array<vk::Pipeline, 4>& libraries, bool optimize)
+	{
+		auto library = vk::PipelineLibraryCreateInfoKHR()
+			.setLibraries(libraries);
+		auto info = vk::GraphicsPipelineCreateInfo()
+			.setPNext(&library)
+			.setLayout(layout);
+		if (optimize)
+			info.setFlags(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT);
+		return device->GetPipelineCache().CreateGraphicsPipeline(info);
 	}
+#endif
 };
 
 
@@ -281,8 +662,9 @@ class ComputePipelineBuilder
 {
 	private:
 	vk::PipelineShaderStageCreateInfo shader_stage;
-	std::vector<vk::ShaderModule> shader_modules;
+	std::vector<ShaderModule> shader_modules;
 	vk::PipelineLayout layout;
+	SpecializationConstants specialization;
 	Device device;
 	public:
 	ComputePipelineBuilder(Device device):
@@ -291,29 +673,10 @@ class ComputePipelineBuilder
 
 	auto AddShaderFromFile(const std::string path, vk::ShaderStageFlagBits stage, const char* entry_point = "main")
 	{
-		std::vector<char> bytes;
-
-		auto file = std::ifstream(path, std::ios::ate | std::ios::binary);
-		if (!file)
-			throw(std::exception(("File not found: " + path + ".").data()));
-		if (file.is_open())
-		{
-			size_t fileSize = (size_t)file.tellg();
-			bytes.resize(fileSize);
-			file.seekg(0);
-			file.read(bytes.data(), fileSize);
-			file.close();
-		}
-		shader_modules.emplace_back(
-			device->createShaderModule(
-				vk::ShaderModuleCreateInfo()
-					.setCodeSize(bytes.size())
-					.setPCode((uint32_t*)bytes.data())
-			)
-		);
+		shader_modules.emplace_back(device->GetShaderCache().Get(path));
 		shader_stage = 
 			vk::PipelineShaderStageCreateInfo()
-			.setModule(shader_modules.at(shader_modules.size() - 1))
+			.setModule(*shader_modules.at(shader_modules.size() - 1))
 			.setStage(stage)
 			.setPName(entry_point);
 
@@ -322,7 +685,7 @@ class ComputePipelineBuilder
 
 	auto AddPipelineLayout(vk::PipelineLayoutCreateInfo info)
 	{
-		layout = device->createPipelineLayout(info);
+		layout = device->GetLayoutCache().GetPipelineLayout(info);
 		return std::move(*this);
 	}
 
@@ -331,18 +694,79 @@ class ComputePipelineBuilder
 		shader_stage = info;
 		return std::move(*this);
 	}
+
+	auto SetSpecialization(SpecializationConstants constants)
+	{
+		specialization = constants;
+		return std::move(*this);
+	}
 	auto Build()
 	{
-		auto i = vk::ComputePipelineCreateInfo()
-				.setLayout(layout)
-				.setStage(shader_stage);
+		if (!layout)
+			layout = device->GetLayoutCache().GetPipelineLayout(shader_modules);
+
+		Hasher hasher;
+		hasher.Add(std::string(shader_stage.pName)).Add(layout);
+		auto known = !shader_modules.empty() && static_cast<vk::ShaderModule>(*shader_modules.back()) == shader_stage.module;
+		hasher.Add(known);
+		if (known)
+			hasher.Add(shader_modules.back()->Digest());
+		else
+			hasher.Add(shader_stage.module);
+		specialization.Hash(hasher);
+
+		return device->GetPipelineRegistry().GetOrCreate(hasher.Key(), [&] {
+			auto info = specialization.Info();
+			auto stage = shader_stage;
+			if (!specialization.Empty())
+				stage.setPSpecializationInfo(&info);
+
+			auto i = vk::ComputePipelineCreateInfo()
+					.setLayout(layout)
+					.setStage(stage);
+
+			auto pipeline = device->GetPipelineCache().CreateComputePipeline(i);
+			
+			return std::make_shared<inner::Pipeline>(layout, pipeline, vk::PipelineBindPoint::eCompute ,device);
+		});
+	}
+};
+
+
+// Compiles many pipelines concurrently on a WorkerPool, all of them sharing the device's pipeline cache.
+class PipelineBatchBuilder
+{
+	private:
+	std::vector<std::function<Pipeline()>> m_Jobs;
+	public:
 
-		auto pipeline = device->createComputePipeline(nullptr, i);
-		for(auto mod : shader_modules)
+	auto Add(GraphicsPipelineBuilder builder, Renderpass renderpass, uint32_t colorblend_count)
+	{
+		auto shared = std::make_shared<GraphicsPipelineBuilder>(std::move(builder));
+		m_Jobs.emplace_back([shared, renderpass, colorblend_count] {
+			return shared->Build(renderpass, colorblend_count);
+		});
+		return std::move(*this);
+	}
+
+	auto Add(ComputePipelineBuilder builder)
+	{
+		auto shared = std::make_shared<ComputePipelineBuilder>(std::move(builder));
+		m_Jobs.emplace_back([shared] {
+			return shared->Build();
+		});
+		return std::move(*this);
+	}
+
+	// Futures are returned in the order the builders were added.
+	auto Build(WorkerPool workers)
+	{
+		std::vector<std::future<Pipeline>> pipelines;
+		for (auto& job : m_Jobs)
 		{
-			device->destroyShaderModule(mod);
+			pipelines.emplace_back(workers->Submit(job));
 		}
-		
-		return std::make_shared<inner::Pipeline>(layout, pipeline, vk::PipelineBindPoint::eCompute ,device);
+		m_Jobs.clear();
+		return pipelines;
 	}
 };
@@ -1,6 +1,25 @@
 #pragma once
+#include <array>
+#include <cstring>
+#include <optional>
+
 #include "pipeline.h"
 
+// State changing calls a CommandBuffer recorded versus the ones it dropped because the state was already set.
+struct CommandBufferStats
+{
+    public:
+    uint32_t issued = 0;
+    uint32_t filtered = 0;
+
+    CommandBufferStats& operator+=(const CommandBufferStats& other)
+    {
+        issued += other.issued;
+        filtered += other.filtered;
+        return *this;
+    }
+};
+
 namespace inner
 {
     class Framebuffer : public vk::Framebuffer
@@ -16,7 +35,7 @@ namespace inner
 
         }
 
-        auto Renderpass()
+        const auto& Renderpass()
         {
             return renderpass;
         }
@@ -28,7 +47,7 @@ namespace inner
 
         ~Framebuffer()
         {
-            device->destroyFramebuffer(*this);
+            device->Retire(static_cast<vk::Framebuffer>(*this));
         }
     };
 
@@ -44,9 +63,10 @@ namespace inner
         vk::CommandPool(pool)
         {}
 
+        // Frees the pool's command buffers with it, they can only be pending if submitted before the pool was dropped.
         ~CommandPool()
         {
-            device->destroyCommandPool(*this);
+            device->Retire(static_cast<vk::CommandPool>(*this));
         }
 
         auto Device()
@@ -65,18 +85,318 @@ namespace inner
         }
     };
     
+    // Does not keep its pool alive, whoever allocated it keeps the pool until the buffer is no longer used.
     class CommandBuffer : public vk::CommandBuffer
     {
         private:
-        std::shared_ptr<CommandPool> pool;
+        CommandPool* pool;
+        // Looked up once, draws that flush dynamic state do not touch the device's reference count.
+        const vk::DispatchLoaderDynamic* dispatch;
+
+        // Dynamic state as requested through the setters, fields outside requested come from the bound pipeline.
+        enum StateField : uint32_t
+        {
+            CULL_MODE = 1 << 0,
+            FRONT_FACE = 1 << 1,
+            TOPOLOGY = 1 << 2,
+            DEPTH_TEST = 1 << 3,
+            DEPTH_WRITE = 1 << 4,
+            DEPTH_COMPARE = 1 << 5,
+            STENCIL_TEST = 1 << 6,
+            RASTERIZER_DISCARD = 1 << 7,
+            DEPTH_BIAS = 1 << 8,
+            PRIMITIVE_RESTART = 1 << 9,
+        };
+        DynamicState state;
+        uint32_t requested = 0;
+        bool dirty = false;
+
+        // What has actually been recorded, so draws only emit the commands that change something. Not owning, a
+        // pipeline has to outlive the recordings that bind it either way.
+        Pipeline* bound = nullptr;
+        vk::Pipeline active;
+        DynamicState emitted;
+        bool emitted_valid = false;
+        bool emitted2_valid = false;
+
+        // Shadow of the rest of the bindable state. Sets and push constants are dropped whenever the layout changes
+        // instead of working out layout compatibility.
+        static constexpr uint32_t MAX_SETS = 8;
+        static constexpr uint32_t MAX_VERTEX_BINDINGS = 16;
+        static constexpr uint32_t MAX_PUSH_CONSTANTS = 128;
+        std::optional<vk::Viewport> viewport;
+        std::optional<vk::Rect2D> scissor;
+        std::array<vk::PipelineLayout, 2> set_layouts;
+        std::array<std::array<vk::DescriptorSet, MAX_SETS>, 2> sets;
+        std::array<std::pair<vk::Buffer, vk::DeviceSize>, MAX_VERTEX_BINDINGS> vertex_buffers;
+        vk::Buffer index_buffer;
+        vk::DeviceSize index_offset = 0;
+        vk::IndexType index_type = vk::IndexType::eUint32;
+        vk::PipelineLayout push_layout;
+        vk::ShaderStageFlags push_stages;
+        uint32_t push_offset = 0;
+        uint32_t push_size = 0;
+        std::array<uint8_t, MAX_PUSH_CONSTANTS> push_data;
+        CommandBufferStats stats;
+
+        // Compute and graphics keep separate descriptor set bindings.
+        static size_t BindIndex(vk::PipelineBindPoint bind)
+        {
+            return bind == vk::PipelineBindPoint::eCompute ? 1 : 0;
+        }
+
+        // Returns whether the call has to be recorded, counting it either way.
+        bool Changed(bool changed)
+        {
+            if (changed)
+                stats.issued++;
+            else
+                stats.filtered++;
+            return changed;
+        }
+
+        template <typename T>
+        void Request(T DynamicState::* field, StateField flag, T value)
+        {
+            if ((requested & flag) && state.*field == value)
+            {
+                return;
+            }
+            state.*field = value;
+            requested |= flag;
+            dirty = true;
+        }
+
+        DynamicState Resolve()
+        {
+            auto resolved = bound->Defaults();
+            if (requested & CULL_MODE) resolved.cull_mode = state.cull_mode;
+            if (requested & FRONT_FACE) resolved.front_face = state.front_face;
+            if (requested & TOPOLOGY) resolved.topology = state.topology;
+            if (requested & DEPTH_TEST) resolved.depth_test = state.depth_test;
+            if (requested & DEPTH_WRITE) resolved.depth_write = state.depth_write;
+            if (requested & DEPTH_COMPARE) resolved.depth_compare = state.depth_compare;
+            if (requested & STENCIL_TEST) resolved.stencil_test = state.stencil_test;
+            if (requested & RASTERIZER_DISCARD) resolved.rasterizer_discard = state.rasterizer_discard;
+            if (requested & DEPTH_BIAS) resolved.depth_bias = state.depth_bias;
+            if (requested & PRIMITIVE_RESTART) resolved.primitive_restart = state.primitive_restart;
+            return resolved;
+        }
+
+        // Binds the permutation matching the requested state and records the dynamic state commands that changed.
+        void Flush()
+        {
+            if (!dirty || !bound)
+            {
+                return;
+            }
+            dirty = false;
+
+            auto resolved = Resolve();
+            auto permutation = bound->Permutation(resolved);
+            auto target = permutation ? permutation : bound;
+            if (Changed(target->Handle() != active))
+            {
+                active = target->Handle();
+                static_cast<const vk::CommandBuffer&>(*this).bindPipeline(target->bind(), active);
+            }
+
+            auto& dispatch = *this->dispatch;
+            if (bound->IsExtended())
+            {
+                if (Changed(!emitted_valid || emitted.cull_mode != resolved.cull_mode)) setCullModeEXT(resolved.cull_mode, dispatch);
+                if (Changed(!emitted_valid || emitted.front_face != resolved.front_face)) setFrontFaceEXT(resolved.front_face, dispatch);
+                if (Changed(!emitted_valid || emitted.topology != resolved.topology)) setPrimitiveTopologyEXT(resolved.topology, dispatch);
+                if (Changed(!emitted_valid || emitted.depth_test != resolved.depth_test)) setDepthTestEnableEXT(resolved.depth_test, dispatch);
+                if (Changed(!emitted_valid || emitted.depth_write != resolved.depth_write)) setDepthWriteEnableEXT(resolved.depth_write, dispatch);
+                if (Changed(!emitted_valid || emitted.depth_compare != resolved.depth_compare)) setDepthCompareOpEXT(resolved.depth_compare, dispatch);
+                if (Changed(!emitted_valid || emitted.stencil_test != resolved.stencil_test)) setStencilTestEnableEXT(resolved.stencil_test, dispatch);
+                emitted_valid = true;
+            }
+            if (bound->IsExtended2())
+            {
+                if (Changed(!emitted2_valid || emitted.rasterizer_discard != resolved.rasterizer_discard)) setRasterizerDiscardEnableEXT(resolved.rasterizer_discard, dispatch);
+                if (Changed(!emitted2_valid || emitted.depth_bias != resolved.depth_bias)) setDepthBiasEnableEXT(resolved.depth_bias, dispatch);
+                if (Changed(!emitted2_valid || emitted.primitive_restart != resolved.primitive_restart)) setPrimitiveRestartEnableEXT(resolved.primitive_restart, dispatch);
+                emitted2_valid = true;
+            }
+            emitted = resolved;
+        }
+
+        // Drops the shadow of everything bound, the next bind of anything is recorded again.
+        void Forget()
+        {
+            bound = nullptr;
+            active = nullptr;
+            emitted_valid = false;
+            emitted2_valid = false;
+            viewport.reset();
+            scissor.reset();
+            set_layouts = {};
+            sets = {};
+            vertex_buffers = {};
+            index_buffer = nullptr;
+            push_layout = nullptr;
+        }
+
         public:
-        CommandBuffer(vk::CommandBuffer buffer, std::shared_ptr<CommandPool> pool):
-        vk::CommandBuffer(buffer), pool(pool)
+        CommandBuffer(vk::CommandBuffer buffer, CommandPool& pool):
+        vk::CommandBuffer(buffer), pool(&pool), dispatch(&pool.Device()->Dispatch())
         {}
 
-        void bindFramebuffer(std::shared_ptr<Framebuffer> framebuffer, vk::SubpassContents content = vk::SubpassContents::eInline)
+        // Recording starts over with no state, whatever the previous recording left behind is forgotten.
+        void begin(const vk::CommandBufferBeginInfo& info)
+        {
+            requested = 0;
+            dirty = false;
+            Forget();
+            stats = {};
+            static_cast<const vk::CommandBuffer&>(*this).begin(info);
+        }
+
+        // All state bound in this buffer is undefined after the secondaries ran, so the shadow is dropped with it.
+        // Requested dynamic state is kept and applies again once a pipeline is bound.
+        void executeCommands(vk::ArrayProxy<const vk::CommandBuffer> buffers)
+        {
+            static_cast<const vk::CommandBuffer&>(*this).executeCommands(buffers);
+            Forget();
+        }
+
+        // Counts since the last begin.
+        const CommandBufferStats& GetStats()
+        {
+            return stats;
+        }
+
+        void setViewport(uint32_t first, vk::ArrayProxy<const vk::Viewport> viewports)
+        {
+            if (first == 0 && viewports.size() == 1)
+            {
+                if (!Changed(!viewport || *viewport != *viewports.begin()))
+                    return;
+                viewport = *viewports.begin();
+            }
+            else if (first == 0)
+            {
+                viewport.reset();
+            }
+            static_cast<const vk::CommandBuffer&>(*this).setViewport(first, viewports);
+        }
+
+        void setScissor(uint32_t first, vk::ArrayProxy<const vk::Rect2D> scissors)
+        {
+            if (first == 0 && scissors.size() == 1)
+            {
+                if (!Changed(!scissor || *scissor != *scissors.begin()))
+                    return;
+                scissor = *scissors.begin();
+            }
+            else if (first == 0)
+            {
+                scissor.reset();
+            }
+            static_cast<const vk::CommandBuffer&>(*this).setScissor(first, scissors);
+        }
+
+        // Binds with dynamic offsets are always recorded, the offsets usually change per draw anyway.
+        void bindDescriptorSets(vk::PipelineBindPoint bind, vk::PipelineLayout layout, uint32_t first,
+            vk::ArrayProxy<const vk::DescriptorSet> descriptor_sets, vk::ArrayProxy<const uint32_t> dynamic_offsets)
+        {
+            auto& shadow = sets[BindIndex(bind)];
+            auto& shadow_layout = set_layouts[BindIndex(bind)];
+            if (shadow_layout != layout)
+            {
+                shadow = {};
+                shadow_layout = layout;
+            }
+            auto cacheable = dynamic_offsets.empty() && first + descriptor_sets.size() <= MAX_SETS;
+            if (cacheable)
+            {
+                auto same = std::equal(descriptor_sets.begin(), descriptor_sets.end(), shadow.begin() + first);
+                if (!Changed(!same))
+                    return;
+                std::copy(descriptor_sets.begin(), descriptor_sets.end(), shadow.begin() + first);
+            }
+            else
+            {
+                stats.issued++;
+                for (uint32_t x = first; x < std::min<uint32_t>(first + descriptor_sets.size(), MAX_SETS); x++)
+                {
+                    shadow[x] = nullptr;
+                }
+            }
+            static_cast<const vk::CommandBuffer&>(*this).bindDescriptorSets(bind, layout, first, descriptor_sets, dynamic_offsets);
+        }
+
+        void bindVertexBuffers(uint32_t first, vk::ArrayProxy<const vk::Buffer> buffers, vk::ArrayProxy<const vk::DeviceSize> offsets)
+        {
+            auto same = first + buffers.size() <= MAX_VERTEX_BINDINGS;
+            for (uint32_t x = 0; same && x < buffers.size(); x++)
+            {
+                same = vertex_buffers[first + x] == std::pair(buffers.data()[x], offsets.data()[x]);
+            }
+            if (!Changed(!same))
+                return;
+            for (uint32_t x = 0; x < buffers.size() && first + x < MAX_VERTEX_BINDINGS; x++)
+            {
+                vertex_buffers[first + x] = std::pair(buffers.data()[x], offsets.data()[x]);
+            }
+            static_cast<const vk::CommandBuffer&>(*this).bindVertexBuffers(first, buffers, offsets);
+        }
+
+        void bindIndexBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::IndexType type)
+        {
+            if (!Changed(index_buffer != buffer || index_offset != offset || index_type != type))
+                return;
+            index_buffer = buffer;
+            index_offset = offset;
+            index_type = type;
+            static_cast<const vk::CommandBuffer&>(*this).bindIndexBuffer(buffer, offset, type);
+        }
+
+        // Only a push identical to the last one on the same layout is dropped, partial overlaps are recorded.
+        void pushConstants(vk::PipelineLayout layout, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* values)
+        {
+            auto same = layout == push_layout && stages == push_stages && offset == push_offset && size == push_size
+                && std::memcmp(push_data.data(), values, size) == 0;
+            if (!Changed(!same))
+                return;
+            if (size <= MAX_PUSH_CONSTANTS)
+            {
+                push_layout = layout;
+                push_stages = stages;
+                push_offset = offset;
+                push_size = size;
+                std::memcpy(push_data.data(), values, size);
+            }
+            else
+            {
+                push_layout = nullptr;
+            }
+            static_cast<const vk::CommandBuffer&>(*this).pushConstants(layout, stages, offset, size, values);
+        }
+
+        // Begins a secondary buffer that continues subpass of framebuffer's renderpass. Viewport and scissor are
+        // not inherited from the primary, so they are set to the framebuffer here like bindFramebuffer does.
+        void begin(Framebuffer& framebuffer, uint32_t subpass = 0)
+        {
+            auto inheritance = vk::CommandBufferInheritanceInfo()
+                .setRenderPass(*framebuffer.Renderpass())
+                .setSubpass(subpass)
+                .setFramebuffer(framebuffer);
+            begin(vk::CommandBufferBeginInfo()
+                .setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+                .setPInheritanceInfo(&inheritance));
+
+            auto size = framebuffer.Size();
+            setViewport(0, vk::Viewport().setWidth((float)size.width).setHeight((float)size.height).setMaxDepth(1.0f));
+            setScissor(0, vk::Rect2D().setExtent(size));
+        }
+
+        // clear_values is indexed by attachment, only entries for attachments with eClear are read.
+        void bindFramebuffer(Framebuffer& framebuffer, vk::SubpassContents content = vk::SubpassContents::eInline, vk::ArrayProxy<const vk::ClearValue> clear_values = nullptr)
         {	   
-            auto size = framebuffer->Size();
+            auto size = framebuffer.Size();
             auto view = vk::Viewport()
                 .setWidth((float)size.width)
                 .setHeight((float)size.height)
@@ -88,16 +408,176 @@ namespace inner
             setScissor(0, scissor);
             beginRenderPass(
                 vk::RenderPassBeginInfo()
-                    .setFramebuffer(*framebuffer)
+                    .setFramebuffer(framebuffer)
                     .setRenderArea(scissor)
-                    .setRenderPass(*framebuffer->Renderpass())
-                    .setClearValues({}) // TODO
+                    .setRenderPass(*framebuffer.Renderpass())
+                    .setClearValueCount(clear_values.size())
+                    .setPClearValues(clear_values.data())
             , content);
         }
 
-        void bindPipeline(std::shared_ptr<Pipeline> pipeline)
+        void bindFramebuffer(const std::shared_ptr<Framebuffer>& framebuffer, vk::SubpassContents content = vk::SubpassContents::eInline, vk::ArrayProxy<const vk::ClearValue> clear_values = nullptr)
+        {
+            bindFramebuffer(*framebuffer, content, clear_values);
+        }
+
+        void bindPipeline(Pipeline& pipeline)
+        {
+            if (pipeline.bind() == vk::PipelineBindPoint::eGraphics)
+            {
+                bound = pipeline.IsDynamic() ? &pipeline : nullptr;
+                // State a pipeline bakes in replaces the dynamic state recorded before it.
+                emitted_valid = emitted_valid && pipeline.IsExtended();
+                emitted2_valid = emitted2_valid && pipeline.IsExtended2();
+                if (bound)
+                {
+                    dirty = true;
+                    Flush();
+                    return;
+                }
+                if (!Changed(pipeline.Handle() != active))
+                    return;
+                active = pipeline.Handle();
+            }
+            else
+            {
+                stats.issued++;
+            }
+            static_cast<const vk::CommandBuffer&>(*this).bindPipeline(pipeline.bind(), pipeline.Handle());
+        }
+
+        void bindPipeline(const std::shared_ptr<Pipeline>& pipeline)
+        {
+            bindPipeline(*pipeline);
+        }
+
+        // Setters for the DynamicState of pipelines built with SetDynamicState. Repeating a value is free,
+        // changes are recorded at the next draw.
+        void setCullMode(vk::CullModeFlags mode) { Request(&DynamicState::cull_mode, CULL_MODE, mode); }
+        void setFrontFace(vk::FrontFace face) { Request(&DynamicState::front_face, FRONT_FACE, face); }
+        void setPrimitiveTopology(vk::PrimitiveTopology topology) { Request(&DynamicState::topology, TOPOLOGY, topology); }
+        void setDepthTestEnable(bool enable) { Request(&DynamicState::depth_test, DEPTH_TEST, enable); }
+        void setDepthWriteEnable(bool enable) { Request(&DynamicState::depth_write, DEPTH_WRITE, enable); }
+        void setDepthCompareOp(vk::CompareOp op) { Request(&DynamicState::depth_compare, DEPTH_COMPARE, op); }
+        void setStencilTestEnable(bool enable) { Request(&DynamicState::stencil_test, STENCIL_TEST, enable); }
+        void setRasterizerDiscardEnable(bool enable) { Request(&DynamicState::rasterizer_discard, RASTERIZER_DISCARD, enable); }
+        void setDepthBiasEnable(bool enable) { Request(&DynamicState::depth_bias, DEPTH_BIAS, enable); }
+        void setPrimitiveRestartEnable(bool enable) { Request(&DynamicState::primitive_restart, PRIMITIVE_RESTART, enable); }
+
+        void setDynamicState(const DynamicState& dynamic)
+        {
+            setCullMode(dynamic.cull_mode);
+            setFrontFace(dynamic.front_face);
+            setPrimitiveTopology(dynamic.topology);
+            setDepthTestEnable(dynamic.depth_test);
+            setDepthWriteEnable(dynamic.depth_write);
+            setDepthCompareOp(dynamic.depth_compare);
+            setStencilTestEnable(dynamic.stencil_test);
+            setRasterizerDiscardEnable(dynamic.rasterizer_discard);
+            setDepthBiasEnable(dynamic.depth_bias);
+            setPrimitiveRestartEnable(dynamic.primitive_restart);
+        }
+
+        void draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance)
+        {
+            Flush();
+            static_cast<const vk::CommandBuffer&>(*this).draw(vertex_count, instance_count, first_vertex, first_instance);
+        }
+
+        void drawIndexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance)
+        {
+            Flush();
+            static_cast<const vk::CommandBuffer&>(*this).drawIndexed(index_count, instance_count, first_index, vertex_offset, first_instance);
+        }
+
+        void drawIndirect(vk::Buffer buffer, vk::DeviceSize offset, uint32_t draw_count, uint32_t stride)
+        {
+            Flush();
+            static_cast<const vk::CommandBuffer&>(*this).drawIndirect(buffer, offset, draw_count, stride);
+        }
+
+        void drawIndexedIndirect(vk::Buffer buffer, vk::DeviceSize offset, uint32_t draw_count, uint32_t stride)
+        {
+            Flush();
+            static_cast<const vk::CommandBuffer&>(*this).drawIndexedIndirect(buffer, offset, draw_count, stride);
+        }
+
+        // Needs Device::HasDrawIndirectCount.
+        void drawIndexedIndirectCount(vk::Buffer buffer, vk::DeviceSize offset, vk::Buffer count_buffer, vk::DeviceSize count_offset, uint32_t max_draw_count, uint32_t stride)
         {
-            static_cast<const vk::CommandBuffer&>(*this).bindPipeline(pipeline->bind(), *pipeline);
+            Flush();
+            static_cast<const vk::CommandBuffer&>(*this).drawIndexedIndirectCount(buffer, offset, count_buffer, count_offset, max_draw_count, stride);
+        }
+    };
+
+    // One eTransient pool per frame in flight for command buffers recorded every frame. Begin(frame) resets the
+    // frame's pool with a single vkResetCommandPool and hands its buffers out again, nothing is freed per frame.
+    class CommandPoolRing
+    {
+        private:
+        struct Frame
+        {
+            std::shared_ptr<CommandPool> pool;
+            std::vector<std::shared_ptr<CommandBuffer>> primary;
+            std::vector<std::shared_ptr<CommandBuffer>> secondary;
+            size_t used_primary = 0;
+            size_t used_secondary = 0;
+        };
+
+        std::vector<Frame> frames;
+        Frame* current = nullptr;
+
+        public:
+        CommandPoolRing(std::shared_ptr<Device> device, uint32_t family, uint32_t frame_count):
+        frames(frame_count)
+        {
+            for (auto& frame : frames)
+            {
+                frame.pool = std::make_shared<CommandPool>(device, device->createCommandPool(
+                    vk::CommandPoolCreateInfo()
+                        .setQueueFamilyIndex(family)
+                        .setFlags(vk::CommandPoolCreateFlagBits::eTransient)));
+            }
+            current = &frames.front();
+        }
+
+        // Only valid once the GPU finished the frame that last used this slot, e.g. right after Swapchain::AquireNextImage.
+        void Begin(uint32_t frame)
+        {
+            current = &frames.at(frame % frames.size());
+            current->pool->Reset();
+            current->used_primary = 0;
+            current->used_secondary = 0;
+        }
+
+        // A buffer from the current frame's pool, valid until that frame slot comes around again.
+        CommandBuffer& Allocate(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
+        {
+            auto secondary = level == vk::CommandBufferLevel::eSecondary;
+            auto& buffers = secondary ? current->secondary : current->primary;
+            auto& used = secondary ? current->used_secondary : current->used_primary;
+            if (used == buffers.size())
+            {
+                auto buffer = current->pool->Device()->allocateCommandBuffers(
+                    vk::CommandBufferAllocateInfo()
+                        .setCommandPool(*current->pool)
+                        .setCommandBufferCount(1)
+                        .setLevel(level)
+                ).front();
+                buffers.push_back(std::make_shared<CommandBuffer>(buffer, *current->pool));
+            }
+            return *buffers[used++];
+        }
+
+        // Summed over the buffers the current frame allocated so far, for per-frame counters.
+        CommandBufferStats GetStats()
+        {
+            CommandBufferStats total;
+            for (size_t x = 0; x < current->used_primary; x++)
+                total += current->primary[x]->GetStats();
+            for (size_t x = 0; x < current->used_secondary; x++)
+                total += current->secondary[x]->GetStats();
+            return total;
         }
     };
 
@@ -106,6 +586,7 @@ namespace inner
 using CommandPool = std::shared_ptr<inner::CommandPool>;
 using CommandBuffer = std::shared_ptr<inner::CommandBuffer>;
 using Framebuffer = std::shared_ptr<inner::Framebuffer>;
+using CommandPoolRing = std::shared_ptr<inner::CommandPoolRing>;
 
 class FramebufferBuilder
 {
@@ -117,6 +598,12 @@ class FramebufferBuilder
         attachments.push_back(attachment);
         return *this;
     }
+
+    const auto& Attachments() const
+    {
+        return attachments;
+    }
+
     auto Build(Device device, vk::Extent2D size, Renderpass renderpass)
     {
         auto f = vk::FramebufferCreateInfo()
@@ -150,7 +637,9 @@ class CommandBufferBuilder
     auto SetLevel(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
     {
         this->level = level;
+        return *this;
     }
+    // The buffers do not hold on to pool, it has to outlive them.
     auto Build(CommandPool pool, uint32_t count)
     {
         auto buffers = pool->Device()->allocateCommandBuffers(
@@ -164,9 +653,19 @@ class CommandBufferBuilder
         for (auto buffer : buffers)
         {
             ret.emplace_back(
-                std::make_shared<inner::CommandBuffer>(buffer, pool)
+                std::make_shared<inner::CommandBuffer>(buffer, *pool)
             );
         }
         return ret;
     }
 };
+
+class CommandPoolRingBuilder
+{
+    public:
+    // frames is the number of frames in flight, each gets its own pool.
+    auto Build(Queue queue, uint32_t frames)
+    {
+        return std::make_shared<inner::CommandPoolRing>(queue.Device(), queue.Family(), std::max(frames, 1u));
+    }
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <functional>
+#include <future>
+
+#include "pool.h"
+#include "worker.h"
+
+namespace inner
+{
+    // Records one subpass across the worker pool. Each frame in flight has a command pool per range, a range is only
+    // ever recorded by one task at a time, so pools never need a lock. The secondaries are executed in range order,
+    // which makes the result independent of how the workers were scheduled.
+    class ParallelRecorder
+    {
+        private:
+        struct Range
+        {
+            std::unique_ptr<CommandPool> pool;
+            std::vector<std::shared_ptr<CommandBuffer>> buffers;
+            size_t used = 0;
+        };
+
+        std::shared_ptr<Device> device;
+        std::shared_ptr<WorkerPool> workers;
+        std::vector<std::vector<Range>> frames;
+        std::vector<Range>* current = nullptr;
+
+        CommandBuffer& Next(Range& range)
+        {
+            if (range.used == range.buffers.size())
+            {
+                auto buffer = device->allocateCommandBuffers(
+                    vk::CommandBufferAllocateInfo()
+                        .setCommandPool(*range.pool)
+                        .setCommandBufferCount(1)
+                        .setLevel(vk::CommandBufferLevel::eSecondary)
+                ).front();
+                range.buffers.push_back(std::make_shared<CommandBuffer>(buffer, *range.pool));
+            }
+            return *range.buffers[range.used++];
+        }
+
+        public:
+        ParallelRecorder(Queue queue, std::shared_ptr<WorkerPool> workers, uint32_t frame_count, uint32_t ranges):
+        device(queue.Device()), workers(workers), frames(frame_count)
+        {
+            for (auto& frame : frames)
+            {
+                frame.resize(ranges);
+                for (auto& range : frame)
+                {
+                    range.pool = std::make_unique<CommandPool>(device, device->createCommandPool(
+                        vk::CommandPoolCreateInfo()
+                            .setQueueFamilyIndex(queue.Family())
+                            .setFlags(vk::CommandPoolCreateFlagBits::eTransient)));
+                }
+            }
+            current = &frames.front();
+        }
+
+        // Resets the frame's pools in bulk, only valid once the GPU finished the frame that last used this slot.
+        void Begin(uint32_t frame)
+        {
+            current = &frames.at(frame % frames.size());
+            for (auto& range : *current)
+            {
+                range.pool->Reset();
+                range.used = 0;
+            }
+        }
+
+        // Splits [0, count) into contiguous ranges and calls record(buffer, begin, end) for each on its own
+        // secondary, the calling thread takes the first range. primary has to be inside the subpass, begun with
+        // vk::SubpassContents::eSecondaryCommandBuffers. Exceptions from record are rethrown here.
+        void Record(CommandBuffer& primary, Framebuffer& framebuffer, uint32_t subpass, uint32_t count,
+            const std::function<void(CommandBuffer&, uint32_t, uint32_t)>& record)
+        {
+            auto& ranges = *current;
+            auto used = std::max<uint32_t>(1, std::min<uint32_t>(count, static_cast<uint32_t>(ranges.size())));
+            auto per_range = (count + used - 1) / used;
+
+            std::vector<CommandBuffer*> buffers(used);
+            auto task = [&](uint32_t index) {
+                auto& buffer = Next(ranges[index]);
+                buffer.begin(framebuffer, subpass);
+                auto begin = std::min(count, index * per_range);
+                auto end = std::min(count, begin + per_range);
+                if (begin < end)
+                    record(buffer, begin, end);
+                buffer.end();
+                buffers[index] = &buffer;
+            };
+
+            std::vector<std::future<void>> pending;
+            for (uint32_t x = 1; x < used; x++)
+            {
+                pending.push_back(workers->Submit([&task, x] { task(x); }));
+            }
+            std::exception_ptr error;
+            try
+            {
+                task(0);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            for (auto& future : pending)
+            {
+                try
+                {
+                    future.get();
+                }
+                catch (...)
+                {
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+
+            std::vector<vk::CommandBuffer> handles;
+            for (auto buffer : buffers)
+            {
+                handles.push_back(*buffer);
+            }
+            primary.executeCommands(handles);
+        }
+
+        auto Ranges()
+        {
+            return static_cast<uint32_t>(frames.front().size());
+        }
+    };
+};
+
+using ParallelRecorder = std::shared_ptr<inner::ParallelRecorder>;
+
+class ParallelRecorderBuilder
+{
+    private:
+    uint32_t m_Ranges = 0;
+    public:
+    // Secondaries per Record call, defaults to one per worker plus the calling thread.
+    auto SetRanges(uint32_t ranges)
+    {
+        m_Ranges = ranges;
+        return *this;
+    }
+
+    // frames is the number of frames in flight, each gets its own set of pools.
+    auto Build(Queue queue, WorkerPool workers, uint32_t frames)
+    {
+        auto ranges = m_Ranges ? m_Ranges : workers->Size() + 1;
+        return std::make_shared<inner::ParallelRecorder>(queue, workers, std::max(frames, 1u), ranges);
+    }
+};
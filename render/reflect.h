@@ -0,0 +1,443 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+struct ReflectedBinding
+{
+    public:
+    uint32_t set;
+    uint32_t binding;
+    vk::DescriptorType type;
+    uint32_t count;
+};
+
+struct ReflectedInput
+{
+    public:
+    uint32_t location;
+    vk::Format format;
+    uint32_t size;
+};
+
+struct ReflectedSpecialization
+{
+    public:
+    uint32_t id;
+    uint32_t size;
+};
+
+struct ShaderReflection
+{
+    public:
+    vk::ShaderStageFlags stage;
+    std::vector<ReflectedBinding> bindings;
+    uint32_t push_constant_offset = 0;
+    uint32_t push_constant_size = 0;
+    std::vector<ReflectedSpecialization> specialization;
+    std::vector<ReflectedInput> inputs;
+};
+
+// Walks a SPIR-V binary once and collects everything needed to build descriptor set layouts, pipeline layouts,
+// vertex input and specialization info. Only the opcodes relevant to the shader interface are looked at.
+class SpirvReflector
+{
+    private:
+    enum Op : uint32_t
+    {
+        OpEntryPoint = 15,
+        OpTypeVoid = 19,
+        OpTypeBool = 20,
+        OpTypeInt = 21,
+        OpTypeFloat = 22,
+        OpTypeVector = 23,
+        OpTypeMatrix = 24,
+        OpTypeImage = 25,
+        OpTypeSampler = 26,
+        OpTypeSampledImage = 27,
+        OpTypeArray = 28,
+        OpTypeRuntimeArray = 29,
+        OpTypeStruct = 30,
+        OpTypePointer = 32,
+        OpConstant = 43,
+        OpSpecConstantTrue = 48,
+        OpSpecConstantFalse = 49,
+        OpSpecConstant = 50,
+        OpVariable = 59,
+        OpDecorate = 71,
+        OpMemberDecorate = 72,
+        OpTypeAccelerationStructureKHR = 5341,
+    };
+
+    enum Decoration : uint32_t
+    {
+        SpecId = 1,
+        Block = 2,
+        BufferBlock = 3,
+        ArrayStride = 6,
+        MatrixStride = 7,
+        BuiltIn = 11,
+        Location = 30,
+        Binding = 33,
+        DescriptorSet = 34,
+        Offset = 35,
+    };
+
+    enum Storage : uint32_t
+    {
+        UniformConstant = 0,
+        Input = 1,
+        Uniform = 2,
+        PushConstant = 9,
+        StorageBuffer = 12,
+    };
+
+    struct Type
+    {
+        uint32_t op;
+        std::vector<uint32_t> operands;
+    };
+
+    struct Decorations
+    {
+        std::optional<uint32_t> set;
+        std::optional<uint32_t> binding;
+        std::optional<uint32_t> location;
+        std::optional<uint32_t> spec_id;
+        uint32_t array_stride = 0;
+        bool builtin = false;
+        bool buffer_block = false;
+    };
+
+    struct Member
+    {
+        uint32_t offset = 0;
+        uint32_t matrix_stride = 0;
+    };
+
+    struct Variable
+    {
+        uint32_t id;
+        uint32_t type;
+        uint32_t storage;
+    };
+
+    std::unordered_map<uint32_t, Type> types;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::unordered_map<uint32_t, Decorations> decorations;
+    std::unordered_map<uint64_t, Member> members;
+    std::vector<Variable> variables;
+    std::vector<std::pair<uint32_t, uint32_t>> spec_constants;
+    uint32_t execution_model = 0;
+
+    static uint64_t MemberKey(uint32_t type, uint32_t member)
+    {
+        return (uint64_t(type) << 32) | member;
+    }
+
+    const Type& GetType(uint32_t id)
+    {
+        auto type = types.find(id);
+        if (type == types.end())
+        {
+            throw(std::exception("SPIR-V references an unknown type"));
+        }
+        return type->second;
+    }
+
+    uint32_t SizeOf(uint32_t id, uint32_t matrix_stride = 0)
+    {
+        auto& type = GetType(id);
+        switch (type.op)
+        {
+            case OpTypeBool:
+                return 4;
+            case OpTypeInt:
+            case OpTypeFloat:
+                return type.operands[0] / 8;
+            case OpTypeVector:
+                return SizeOf(type.operands[0]) * type.operands[1];
+            case OpTypeMatrix:
+                return (matrix_stride ? matrix_stride : SizeOf(type.operands[0])) * type.operands[1];
+            case OpTypeArray:
+            {
+                auto stride = decorations[id].array_stride;
+                return (stride ? stride : SizeOf(type.operands[0])) * constants[type.operands[1]];
+            }
+            case OpTypeStruct:
+            {
+                uint32_t size = 0;
+                for (uint32_t x = 0; x < type.operands.size(); x++)
+                {
+                    auto& member = members[MemberKey(id, x)];
+                    size = std::max(size, member.offset + SizeOf(type.operands[x], member.matrix_stride));
+                }
+                return size;
+            }
+            default:
+                return 0;
+        }
+    }
+
+    vk::ShaderStageFlags Stage()
+    {
+        switch (execution_model)
+        {
+            case 0: return vk::ShaderStageFlagBits::eVertex;
+            case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+            case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+            case 3: return vk::ShaderStageFlagBits::eGeometry;
+            case 4: return vk::ShaderStageFlagBits::eFragment;
+            case 5: return vk::ShaderStageFlagBits::eCompute;
+            default: return vk::ShaderStageFlagBits::eAll;
+        }
+    }
+
+    std::optional<vk::DescriptorType> DescriptorType(const Type& type, uint32_t id, uint32_t storage)
+    {
+        switch (type.op)
+        {
+            case OpTypeStruct:
+                if (storage == StorageBuffer || decorations[id].buffer_block)
+                    return vk::DescriptorType::eStorageBuffer;
+                return vk::DescriptorType::eUniformBuffer;
+            case OpTypeSampler:
+                return vk::DescriptorType::eSampler;
+            case OpTypeSampledImage:
+                if (GetType(type.operands[0]).operands[1] == 5)
+                    return vk::DescriptorType::eUniformTexelBuffer;
+                return vk::DescriptorType::eCombinedImageSampler;
+            case OpTypeImage:
+            {
+                auto dim = type.operands[1];
+                auto storage_image = type.operands[5] == 2;
+                if (dim == 6)
+                    return vk::DescriptorType::eInputAttachment;
+                if (dim == 5)
+                    return storage_image ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+                return storage_image ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+            }
+            case OpTypeAccelerationStructureKHR:
+                return vk::DescriptorType::eAccelerationStructureKHR;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    vk::Format InputFormat(const Type& type)
+    {
+        auto components = 1u;
+        auto scalar = &type;
+        if (type.op == OpTypeVector)
+        {
+            components = type.operands[1];
+            scalar = &GetType(type.operands[0]);
+        }
+        auto width = scalar->operands[0];
+
+        if (scalar->op == OpTypeFloat)
+        {
+            const vk::Format formats[3][4] = {
+                {vk::Format::eR16Sfloat, vk::Format::eR16G16Sfloat, vk::Format::eR16G16B16Sfloat, vk::Format::eR16G16B16A16Sfloat},
+                {vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat},
+                {vk::Format::eR64Sfloat, vk::Format::eR64G64Sfloat, vk::Format::eR64G64B64Sfloat, vk::Format::eR64G64B64A64Sfloat},
+            };
+            return formats[width == 16 ? 0 : width == 32 ? 1 : 2][components - 1];
+        }
+        if (scalar->op == OpTypeInt)
+        {
+            auto sign = scalar->operands[1] != 0;
+            const vk::Format formats[2][2][4] = {
+                {
+                    {vk::Format::eR16Uint, vk::Format::eR16G16Uint, vk::Format::eR16G16B16Uint, vk::Format::eR16G16B16A16Uint},
+                    {vk::Format::eR16Sint, vk::Format::eR16G16Sint, vk::Format::eR16G16B16Sint, vk::Format::eR16G16B16A16Sint},
+                },
+                {
+                    {vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint},
+                    {vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint},
+                },
+            };
+            return formats[width == 16 ? 0 : 1][sign][components - 1];
+        }
+        throw(std::exception("Unsupported vertex input type"));
+        return vk::Format::eUndefined;
+    }
+
+    void Parse(const uint32_t* code, size_t count)
+    {
+        if (count < 5 || code[0] != 0x07230203)
+        {
+            throw(std::exception("Invalid SPIR-V module"));
+        }
+
+        for (size_t offset = 5; offset < count;)
+        {
+            auto op = code[offset] & 0xFFFF;
+            auto length = code[offset] >> 16;
+            if (length == 0 || offset + length > count)
+            {
+                throw(std::exception("Malformed SPIR-V instruction"));
+            }
+            auto words = code + offset;
+
+            switch (op)
+            {
+                case OpEntryPoint:
+                    execution_model = words[1];
+                    break;
+                case OpTypeVoid:
+                case OpTypeBool:
+                case OpTypeInt:
+                case OpTypeFloat:
+                case OpTypeVector:
+                case OpTypeMatrix:
+                case OpTypeImage:
+                case OpTypeSampler:
+                case OpTypeSampledImage:
+                case OpTypeArray:
+                case OpTypeRuntimeArray:
+                case OpTypeStruct:
+                case OpTypePointer:
+                case OpTypeAccelerationStructureKHR:
+                    types[words[1]] = Type{op, std::vector<uint32_t>(words + 2, words + length)};
+                    break;
+                case OpConstant:
+                case OpSpecConstant:
+                    constants[words[2]] = words[3];
+                    if (op == OpSpecConstant)
+                        spec_constants.emplace_back(words[2], words[1]);
+                    break;
+                case OpSpecConstantTrue:
+                case OpSpecConstantFalse:
+                    spec_constants.emplace_back(words[2], words[1]);
+                    break;
+                case OpVariable:
+                    variables.push_back(Variable{words[2], words[1], words[3]});
+                    break;
+                case OpDecorate:
+                {
+                    auto& d = decorations[words[1]];
+                    switch (words[2])
+                    {
+                        case SpecId: d.spec_id = words[3]; break;
+                        case BufferBlock: d.buffer_block = true; break;
+                        case ArrayStride: d.array_stride = words[3]; break;
+                        case BuiltIn: d.builtin = true; break;
+                        case Location: d.location = words[3]; break;
+                        case Binding: d.binding = words[3]; break;
+                        case DescriptorSet: d.set = words[3]; break;
+                    }
+                    break;
+                }
+                case OpMemberDecorate:
+                {
+                    auto& m = members[MemberKey(words[1], words[2])];
+                    switch (words[3])
+                    {
+                        case Offset: m.offset = words[4]; break;
+                        case MatrixStride: m.matrix_stride = words[4]; break;
+                        case BuiltIn: decorations[words[1]].builtin = true; break;
+                    }
+                    break;
+                }
+            }
+            offset += length;
+        }
+    }
+
+    public:
+    ShaderReflection Reflect(const uint32_t* code, size_t count)
+    {
+        Parse(code, count);
+
+        ShaderReflection reflection;
+        reflection.stage = Stage();
+
+        for (auto& variable : variables)
+        {
+            auto& pointer = GetType(variable.type);
+            auto pointee = pointer.operands[1];
+            auto& d = decorations[variable.id];
+
+            switch (variable.storage)
+            {
+                case UniformConstant:
+                case Uniform:
+                case StorageBuffer:
+                {
+                    if (!d.binding)
+                        break;
+                    uint32_t descriptors = 1;
+                    auto type = &GetType(pointee);
+                    while (type->op == OpTypeArray || type->op == OpTypeRuntimeArray)
+                    {
+                        if (type->op == OpTypeArray)
+                            descriptors *= constants[type->operands[1]];
+                        pointee = type->operands[0];
+                        type = &GetType(pointee);
+                    }
+                    auto descriptor = DescriptorType(*type, pointee, variable.storage);
+                    if (descriptor)
+                    {
+                        reflection.bindings.push_back(ReflectedBinding{d.set.value_or(0), *d.binding, *descriptor, descriptors});
+                    }
+                    break;
+                }
+                case PushConstant:
+                {
+                    auto& type = GetType(pointee);
+                    uint32_t start = std::numeric_limits<uint32_t>::max();
+                    for (uint32_t x = 0; x < type.operands.size(); x++)
+                        start = std::min(start, members[MemberKey(pointee, x)].offset);
+                    reflection.push_constant_offset = type.operands.empty() ? 0 : start;
+                    reflection.push_constant_size = SizeOf(pointee) - reflection.push_constant_offset;
+                    break;
+                }
+                case Input:
+                {
+                    if (reflection.stage != vk::ShaderStageFlagBits::eVertex || d.builtin || decorations[pointee].builtin || !d.location)
+                        break;
+                    auto type = &GetType(pointee);
+                    uint32_t elements = 1;
+                    if (type->op == OpTypeArray)
+                    {
+                        elements = constants[type->operands[1]];
+                        type = &GetType(type->operands[0]);
+                    }
+                    auto columns = 1u;
+                    if (type->op == OpTypeMatrix)
+                    {
+                        columns = type->operands[1];
+                        type = &GetType(type->operands[0]);
+                    }
+                    auto format = InputFormat(*type);
+                    auto size = type->op == OpTypeVector
+                        ? SizeOf(type->operands[0]) * type->operands[1]
+                        : type->operands[0] / 8;
+                    for (uint32_t x = 0; x < elements * columns; x++)
+                    {
+                        reflection.inputs.push_back(ReflectedInput{*d.location + x, format, size});
+                    }
+                    break;
+                }
+            }
+        }
+
+        for (auto [id, type] : spec_constants)
+        {
+            auto& d = decorations[id];
+            if (d.spec_id)
+            {
+                reflection.specialization.push_back(ReflectedSpecialization{*d.spec_id, SizeOf(type)});
+            }
+        }
+
+        std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](auto& a, auto& b) { return a.location < b.location; });
+        return reflection;
+    }
+};
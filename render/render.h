@@ -4,12 +4,32 @@
 #include <iostream>
 #include <exception>
 #include <filesystem>
+#include <optional>
 
 #include "platforms/window.h"
 
 #include "swapchain.h"
 #include "pool.h"
 #include "pipeline.h"
+#include "variant.h"
+#include "compute.h"
+#include "upload.h"
+#include "frame.h"
+#include "handle.h"
+#include "record.h"
+#include "drawstream.h"
+#include "indirect.h"
+#include "graph.h"
+#include "passcache.h"
+
+struct RenderSettings
+{
+    // Frames the CPU may record ahead of the GPU, 1 to the number of swapchain images is useful.
+    uint32_t frames_in_flight = 2;
+    LatencyPolicy latency = LatencyPolicy::THROUGHPUT;
+    // Falls back along mailbox, immediate, fifo_relaxed, fifo when the surface does not support it.
+    vk::PresentModeKHR present_mode = vk::PresentModeKHR::eMailbox;
+};
 
 class Render
 {
@@ -17,16 +37,23 @@ private:
 
     Instance instance;
     Device device;
+    ResourcePools resources;
+    RenderpassCache renderpass_cache;
+    FramebufferCache framebuffer_cache;
     Renderpass renderpass;
-    Pipeline pipeline;
+    PipelineHandle pipeline;
     Pipeline compute;
     Swapchain swapchain;
-    std::vector<Framebuffer> framebuffers;
+    std::vector<FramebufferHandle> framebuffers;
     Queue present_queue;
-    CommandPool command_pool;
-    std::vector<CommandBuffer> command_buffers;
-
-    auto setup(Window& window)
+    CommandPoolRing command_pools;
+    WorkerPool workers;
+    ComputeContext compute_context;
+    UploadManager uploads;
+    FrameAllocator frame_allocator;
+    std::optional<vk::Extent2D> pending_size;
+
+    auto setup(Window& window, RenderSettings settings)
     {
         instance = InstanceBuilder()
         .SetStandarValidation()
@@ -45,13 +72,19 @@ private:
 
         auto [device, queues] = DeviceBuilder()
         .SetEnabledFeatures(enabledFeatures)
-        .Build(instance, surface, {QueueType::GENERAL});
+        .SetPipelineCache("pipeline.cache")
+        .SetExtendedDynamicState()
+        .Build(instance, surface, {QueueType::GENERAL, QueueType::COMPUTE, QueueType::TRANSFER});
 
         this->device = device;
 
         present_queue = queues.at(0);
+        compute_context = ComputeContextBuilder().Build(queues.at(1));
+        uploads = UploadManagerBuilder().Build(queues.at(2), present_queue);
+        renderpass_cache = RenderpassCacheBuilder().Build(device);
+        framebuffer_cache = FramebufferCacheBuilder().Build(device);
         
-        renderpass = RenderpassBuilder()
+        renderpass = renderpass_cache->Get(RenderpassBuilder()
         .AddAttachments( {
             {"out_image", Attachment{
                 .load = vk::AttachmentLoadOp::eDontCare,
@@ -63,14 +96,18 @@ private:
         )
         .AddSubpassDescription(Description()
             .AddColors({"out_image"})
-        )
-        .Build(device);
+        ));
+
+        workers = WorkerPoolBuilder().Build();
 
-        pipeline = GraphicsPipelineBuilder(device)
-            .AddShaderFromFile("../../shaders/vert.spv", vk::ShaderStageFlagBits::eVertex)
-            .AddShaderFromFile("../../shaders/frag.spv", vk::ShaderStageFlagBits::eFragment)
-            .AddPipelineLayout(vk::PipelineLayoutCreateInfo())
-            .Build(renderpass, 1);
+        auto pipelines = PipelineBatchBuilder()
+            .Add(GraphicsPipelineBuilder(device)
+                .AddShaderFromFile("../../shaders/vert.spv", vk::ShaderStageFlagBits::eVertex)
+                .AddShaderFromFile("../../shaders/frag.spv", vk::ShaderStageFlagBits::eFragment)
+                .SetDynamicState()
+                .SetLinkWorkers(workers),
+                renderpass, 1)
+            .Build(workers);
 
         // compute = ComputePipelineBuilder(device)
         //     .AddShaderFromFile("../shaders/comp.spv", vk::ShaderStageFlagBits::eCompute)
@@ -79,88 +116,107 @@ private:
         
 
         swapchain = SwapchainBuilder()
-        .SetPresentMode(vk::PresentModeKHR::eMailbox)
+        .SetPresentMode(settings.present_mode)
+        .SetFramesInFlight(settings.frames_in_flight)
+        .SetLatencyPolicy(settings.latency)
         .Build(device, surface, present_queue,vk::Extent2D(800, 600));
 
-        auto image_views = swapchain->GetImageViews();
+        pipeline = resources.pipelines.Insert(pipelines.at(0).get());
 
-        command_pool = CommandPoolBuilder().Build(present_queue);
+        frame_allocator = FrameAllocatorBuilder().Build(device, swapchain->FramesInFlight());
 
-        command_buffers = CommandBufferBuilder().Build(command_pool, image_views.size());
-        
-        for(auto x = 0; x < image_views.size(); x++)
+        command_pools = CommandPoolRingBuilder().Build(present_queue, swapchain->FramesInFlight());
+
+        CreateFrameResources();
+    }
+
+    // Everything that depends on the swapchain images and extent: a framebuffer per image.
+    void CreateFrameResources()
+    {
+        for (auto view : swapchain->GetImageViews())
+        {
+            framebuffers.emplace_back(resources.framebuffers.Insert(
+                framebuffer_cache->Get(FramebufferBuilder().AddAttachment(view), swapchain->GetSize(), renderpass)
+            ));
+        }
+    }
+
+    // Frames already submitted may still use the old framebuffers and swapchain, they retire themselves through the
+    // deletion queue once those frames are done. The old views go away with the swapchain, so their framebuffers
+    // are evicted from the cache first.
+    void Recreate(vk::Extent2D size)
+    {
+        for (auto framebuffer : framebuffers)
         {
-            framebuffers.emplace_back(
-                FramebufferBuilder()
-                .AddAttachment(image_views.at(x))
-                .Build(device, swapchain->GetSize(), renderpass)
-            );
-            command_buffers.at(x)->begin(vk::CommandBufferBeginInfo());
-            // command_buffers.at(x)->bindPipeline(compute);
-            // //command_buffers.at(x)->bindDescriptorSets()
-            // command_buffers.at(x)->dispatch(1024, 0,0);
-            command_buffers.at(x)->bindFramebuffer(framebuffers.at(x));
-            command_buffers.at(x)->bindPipeline(pipeline);
-            command_buffers.at(x)->draw(3, 1, 0 ,0);
-            command_buffers.at(x)->endRenderPass();
-            command_buffers.at(x)->end();
+            resources.framebuffers.Remove(framebuffer);
         }
+        framebuffers.clear();
+        framebuffer_cache->Evict(swapchain->GetImageViews());
+
+        swapchain->RecreateSwapchain(size);
+        CreateFrameResources();
+    }
 
+    void Record(inner::CommandBuffer& buffer, uint32_t index)
+    {
+        buffer.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        // buffer.bindPipeline(compute);
+        // buffer.dispatch(1024, 0,0);
+        buffer.bindFramebuffer(*resources.framebuffers.Get(framebuffers.at(index)));
+        buffer.bindPipeline(*resources.pipelines.Get(pipeline));
+        buffer.draw(3, 1, 0 ,0);
+        buffer.endRenderPass();
+        buffer.end();
     }
 
 public:
-    Render(Window& window)
+    Render(Window& window, RenderSettings settings = {})
     {
-        setup(window);
+        setup(window, settings);
     }
     ~Render()
     {
         device->waitIdle();
+        device->GetDeletionQueue().Collect();
     }
     
 
+    // Only records the size, the swapchain is recreated once at the next DrawFrame however many resizes came in between.
     void Resize(uint32_t width, uint32_t height)
     {
-        device->waitIdle();
-        swapchain->RecreateSwapchain(vk::Extent2D(width, height));
-        auto image_views = swapchain->GetImageViews();
-
-        framebuffers.clear();
-        for(auto x = 0; x < image_views.size(); x++)
-        {
-            framebuffers.emplace_back(
-                FramebufferBuilder()
-                .AddAttachment(image_views.at(x))
-                .Build(device, swapchain->GetSize(), renderpass)
-            );
-            command_buffers.at(x)->begin(vk::CommandBufferBeginInfo());
-            // command_buffers.at(x)->bindPipeline(compute);
-            // command_buffers.at(x)->dispatch(1024, 0,0);
-            command_buffers.at(x)->bindFramebuffer(framebuffers.at(x));
-            command_buffers.at(x)->bindPipeline(pipeline);
-            command_buffers.at(x)->draw(3, 1, 0 ,0);
-            command_buffers.at(x)->endRenderPass();
-            command_buffers.at(x)->end();
-        }
+        pending_size = vk::Extent2D(width, height);
+    }
+    // Call before polling input, with LatencyPolicy::LOW_LATENCY this is where the CPU waits for the GPU.
+    void WaitFrame()
+    {
+        swapchain->WaitFrame();
+    }
 
+    auto GetFrameLatency()
+    {
+        return swapchain->GetFrameLatency();
     }
+
     void DrawFrame()
     {
-        
-		vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+        device->GetDeletionQueue().Collect();
+        if (pending_size)
+        {
+            // Minimized, nothing to present to until the window gets a size again.
+            if (pending_size->width == 0 || pending_size->height == 0)
+                return;
+            if (*pending_size != swapchain->GetSize())
+                Recreate(*pending_size);
+            pending_size.reset();
+        }
 
-        const auto [index, aquire, present, submit_fence] = swapchain->AquireNextImage();
-        
-        auto s = vk::SubmitInfo()
-            .setWaitSemaphoreCount(1)
-            .setSignalSemaphoreCount(1)
-            .setPWaitSemaphores(&aquire)
-            .setPSignalSemaphores(&present)
-            .setCommandBufferCount(1)
-            .setPCommandBuffers(&*command_buffers.at(index))
-            .setPWaitDstStageMask(waitStages);
-
-        present_queue.submit(s, submit_fence);
+        const auto [index, aquire, present] = swapchain->AquireNextImage();
+        frame_allocator->Begin(swapchain->Frame());
+        command_pools->Begin(swapchain->Frame());
+
+        auto& buffer = command_pools->Allocate();
+        Record(buffer, index);
+        swapchain->Submit(SubmitBuilder().AddCommandBuffer(buffer));
 
         swapchain->Present();
 
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <optional>
+
 #include "device.h"
+#include "hash.h"
 
 namespace inner
 {
@@ -8,17 +11,21 @@ namespace inner
 	{
 		private:
 		std::shared_ptr<Device> device;
+		HashKey key;
 		public:
-
-		uint32_t subpass_count;
-
-		Renderpass(vk::RenderPassCreateInfo create_info, std::shared_ptr<Device> device):
-		vk::RenderPass(device->createRenderPass(create_info)), device(device), subpass_count(0)
+		Renderpass(vk::RenderPassCreateInfo create_info, std::shared_ptr<Device> device, HashKey key):
+		vk::RenderPass(device->createRenderPass(create_info)), device(device), key(key)
 		{}
 
+		// RenderpassBuilder::Key of the description, stays unique where the handle value may be reused.
+		const HashKey& Key()
+		{
+			return key;
+		}
+
 		~Renderpass()
 		{
-			device->destroyRenderPass(*this);
+			device->Retire(static_cast<vk::RenderPass>(*this));
 		}
 
 	};
@@ -34,6 +41,9 @@ struct Attachment
 	vk::AttachmentStoreOp store;
 	vk::Format format;
 	vk::SampleCountFlagBits samples;
+	vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+	// eUndefined keeps the default, present for color formats and depth stencil read only for depth formats.
+	vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
 };
 
 struct Description
@@ -63,6 +73,7 @@ class RenderpassBuilder
 	};
 	std::vector<SubpassData> m_PipelineData;
 	std::vector<vk::SubpassDependency> m_Dependencies;
+	std::optional<std::vector<vk::SubpassDependency>> m_External;
 	public:
 
 	RenderpassBuilder()
@@ -146,6 +157,58 @@ class RenderpassBuilder
 
 	}
 
+	// Replaces the default dependencies on VK_SUBPASS_EXTERNAL, which wait on everything before the pass and make
+	// everything after wait on it. An empty list leaves the implicit ones, for callers that synchronise with their
+	// own barriers around the pass.
+	auto SetExternalDependencies(std::vector<vk::SubpassDependency> dependencies)
+	{
+		m_External = dependencies;
+		return std::move(*this);
+	}
+
+	// Everything that ends up in the vk::RenderPassCreateInfo. Attachment names only connect descriptions to
+	// attachments and are left out, so the same layout under other names gives the same key.
+	HashKey Key() const
+	{
+		auto dependency = [](Hasher& hasher, const vk::SubpassDependency& d) {
+			hasher.Add(d.srcSubpass).Add(d.dstSubpass).Add(d.srcStageMask).Add(d.dstStageMask)
+				.Add(d.srcAccessMask).Add(d.dstAccessMask).Add(d.dependencyFlags);
+		};
+		auto reference = [](Hasher& hasher, const vk::AttachmentReference& r) {
+			hasher.Add(r.attachment).Add(r.layout);
+		};
+
+		Hasher hasher;
+		hasher.Add(m_Attachments.size());
+		for (auto& [name, attach] : m_Attachments)
+		{
+			hasher.Add(attach.load).Add(attach.store).Add(attach.format).Add(attach.samples)
+				.Add(attach.initial_layout).Add(attach.final_layout);
+		}
+		hasher.Add(m_PipelineData.size());
+		for (auto& d : m_PipelineData)
+		{
+			hasher.Add(d.color.size());
+			for (auto& r : d.color)
+				reference(hasher, r);
+			hasher.Add(d.input.size());
+			for (auto& r : d.input)
+				reference(hasher, r);
+			reference(hasher, d.depth);
+		}
+		hasher.Add(m_Dependencies.size());
+		for (auto& d : m_Dependencies)
+			dependency(hasher, d);
+		hasher.Add(m_External.has_value());
+		if (m_External)
+		{
+			hasher.Add(m_External->size());
+			for (auto& d : *m_External)
+				dependency(hasher, d);
+		}
+		return hasher.Key();
+	}
+
 	auto Build(Device device)
 	{
 		std::vector<vk::AttachmentDescription> attachments;
@@ -155,7 +218,7 @@ class RenderpassBuilder
 			auto a = vk::AttachmentDescription()
 				.setFormat(attach.format)
 				.setSamples(attach.samples)
-				.setInitialLayout(vk::ImageLayout::eUndefined);
+				.setInitialLayout(attach.initial_layout);
 			switch(attach.format)
 			{
 				case vk::Format::eD16Unorm:
@@ -163,11 +226,13 @@ class RenderpassBuilder
 				case vk::Format::eD24UnormS8Uint:
 				case vk::Format::eD32Sfloat:
 				case vk::Format::eD32SfloatS8Uint:
-				a.setLoadOp(vk::AttachmentLoadOp::eDontCare)
-				.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+				a.setLoadOp(attach.load)
+				.setStoreOp(attach.store)
 				.setStencilLoadOp(attach.load)
 				.setStencilStoreOp(attach.store)
 				.setFinalLayout(vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+				if (attach.final_layout != vk::ImageLayout::eUndefined)
+					a.setFinalLayout(attach.final_layout);
 				attachments.push_back(a);
 				break;
 				default:
@@ -176,32 +241,42 @@ class RenderpassBuilder
 				.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
 				.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
 				.setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
+				if (attach.final_layout != vk::ImageLayout::eUndefined)
+					a.setFinalLayout(attach.final_layout);
 				attachments.push_back(a);
 				break;
 			}
 		}
-		m_Dependencies.push_back(
-			vk::SubpassDependency()
-			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
-			.setDstSubpass(0)
-			.setSrcStageMask(vk::PipelineStageFlagBits::eBottomOfPipe)
-			.setSrcAccessMask(vk::AccessFlagBits::eMemoryRead)
-			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
-			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
-				| vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite));
-
-		m_Dependencies.push_back(
-			vk::SubpassDependency()
-			.setSrcSubpass(0)
-			.setDstSubpass(VK_SUBPASS_EXTERNAL)
-			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
-			.setDstStageMask(vk::PipelineStageFlagBits::eBottomOfPipe)
-			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
-				| vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
-			.setDstAccessMask(vk::AccessFlagBits::eMemoryRead)
-			.setDependencyFlags(vk::DependencyFlagBits::eByRegion)
-
-		);
+		auto dependencies = m_Dependencies;
+		if (m_External)
+		{
+			dependencies.insert(dependencies.end(), m_External->begin(), m_External->end());
+		}
+		else
+		{
+			dependencies.push_back(
+				vk::SubpassDependency()
+				.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+				.setDstSubpass(0)
+				.setSrcStageMask(vk::PipelineStageFlagBits::eBottomOfPipe)
+				.setSrcAccessMask(vk::AccessFlagBits::eMemoryRead)
+				.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
+				.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
+					| vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite));
+
+			dependencies.push_back(
+				vk::SubpassDependency()
+				.setSrcSubpass(0)
+				.setDstSubpass(VK_SUBPASS_EXTERNAL)
+				.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
+				.setDstStageMask(vk::PipelineStageFlagBits::eBottomOfPipe)
+				.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
+					| vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eMemoryRead)
+				.setDependencyFlags(vk::DependencyFlagBits::eByRegion)
+
+			);
+		}
 
 		std::vector<vk::SubpassDescription> subpasses;
 
@@ -220,11 +295,11 @@ class RenderpassBuilder
 
 		auto renderPassInfo = vk::RenderPassCreateInfo()
 			.setAttachments(attachments)
-			.setDependencies(m_Dependencies)
+			.setDependencies(dependencies)
 			.setSubpasses(subpasses);
 
 
-		return std::make_shared<inner::Renderpass>(renderPassInfo, device);
+		return std::make_shared<inner::Renderpass>(renderPassInfo, device, Key());
 
 	}
 };
\ No newline at end of file
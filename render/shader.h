@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+#include "hash.h"
+#include "reflect.h"
+#include "../platforms/file.h"
+
+struct ShaderCacheStats
+{
+    public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+namespace inner
+{
+    // Does not keep the device alive, the device clears its ShaderCache before it is destroyed.
+    class ShaderModule : public vk::ShaderModule
+    {
+        private:
+        vk::Device device;
+        uint64_t hash;
+        Sha256Digest digest;
+        ShaderReflection reflection;
+        public:
+        ShaderModule(vk::ShaderModule module, vk::Device device, uint64_t hash, const Sha256Digest& digest, ShaderReflection reflection):
+        vk::ShaderModule(module), device(device), hash(hash), digest(digest), reflection(reflection)
+        {}
+
+        ~ShaderModule()
+        {
+            device.destroyShaderModule(*this);
+        }
+
+        auto Hash()
+        {
+            return hash;
+        }
+
+        // SHA-256 of the SPIR-V, equal digests mean equal code.
+        const Sha256Digest& Digest()
+        {
+            return digest;
+        }
+
+        const ShaderReflection& Reflection()
+        {
+            return reflection;
+        }
+    };
+
+    // Shader modules keyed by the hash of their SPIR-V. The most recently used modules are kept alive
+    // up to the capacity, older ones live on only as long as a builder still references them. A hit has to match
+    // the SHA-256 of the code as well. Modules are created and reflected outside the lock, so a miss does not
+    // stall other threads looking up shaders.
+    class ShaderCache
+    {
+        private:
+        struct Entry
+        {
+            std::weak_ptr<ShaderModule> module;
+            std::list<std::shared_ptr<ShaderModule>>::iterator recent;
+            bool retained = false;
+        };
+
+        vk::Device device;
+        size_t capacity;
+        std::unordered_map<uint64_t, Entry> modules;
+        std::list<std::shared_ptr<ShaderModule>> recent;
+        std::mutex mutex;
+        ShaderCacheStats stats;
+
+        static uint64_t Hash(const uint32_t* words, size_t count)
+        {
+            uint64_t hash = 14695981039346656037ull ^ count;
+            for (size_t x = 0; x < count; x++)
+            {
+                hash = (hash ^ words[x]) * 1099511628211ull;
+            }
+            return hash;
+        }
+
+        void Retain(Entry& entry, std::shared_ptr<ShaderModule> module)
+        {
+            if (entry.retained)
+            {
+                recent.splice(recent.begin(), recent, entry.recent);
+                return;
+            }
+            recent.push_front(module);
+            entry.recent = recent.begin();
+            entry.retained = true;
+
+            while (recent.size() > capacity)
+            {
+                auto hash = recent.back()->Hash();
+                recent.pop_back();
+                stats.evictions++;
+
+                auto& evicted = modules.at(hash);
+                evicted.retained = false;
+                if (evicted.module.expired())
+                {
+                    modules.erase(hash);
+                }
+            }
+        }
+
+        // Entries whose module expired after it left the recent list are only found here.
+        void Prune()
+        {
+            std::erase_if(modules, [](auto& entry) { return entry.second.module.expired(); });
+        }
+
+        public:
+        ShaderCache(vk::Device device, size_t capacity):
+        device(device), capacity(std::max<size_t>(capacity, 1))
+        {}
+
+        std::shared_ptr<ShaderModule> Get(const uint32_t* code, size_t size)
+        {
+            if (size < sizeof(uint32_t) * 5 || size % sizeof(uint32_t) != 0 || code[0] != 0x07230203)
+            {
+                throw(std::exception("Invalid SPIR-V module"));
+            }
+            auto count = size / sizeof(uint32_t);
+            auto hash = Hash(code, count);
+            auto digest = Sha256(code, size);
+
+            {
+                std::lock_guard lock(mutex);
+                auto found = modules.find(hash);
+                auto cached = found != modules.end() ? found->second.module.lock() : nullptr;
+                if (cached && cached->Digest() == digest)
+                {
+                    stats.hits++;
+                    Retain(found->second, cached);
+                    return cached;
+                }
+                stats.misses++;
+            }
+
+            auto module = std::make_shared<ShaderModule>(
+                device.createShaderModule(
+                    vk::ShaderModuleCreateInfo()
+                        .setCodeSize(size)
+                        .setPCode(code)
+                ),
+                device, hash, digest, SpirvReflector().Reflect(code, count)
+            );
+
+            std::lock_guard lock(mutex);
+            auto found = modules.find(hash);
+            auto cached = found != modules.end() ? found->second.module.lock() : nullptr;
+            if (cached)
+            {
+                // Another thread created the same module meanwhile, ours is dropped.
+                if (cached->Digest() == digest)
+                {
+                    Retain(found->second, cached);
+                    return cached;
+                }
+                // Different code under a live entry's hash, the module is handed out without being cached.
+                return module;
+            }
+
+            Prune();
+            auto& entry = modules[hash];
+            entry.module = module;
+            Retain(entry, module);
+            return module;
+        }
+
+        // The file is mapped rather than read, the driver copies the words straight out of the page cache.
+        std::shared_ptr<ShaderModule> Get(const std::string& path)
+        {
+            auto file = MappedFile(path);
+            return Get(static_cast<const uint32_t*>(file.Data()), file.Size());
+        }
+
+        void Clear()
+        {
+            std::lock_guard lock(mutex);
+            recent.clear();
+            modules.clear();
+        }
+
+        ShaderCacheStats GetStats()
+        {
+            std::lock_guard lock(mutex);
+            return stats;
+        }
+    };
+};
+
+using ShaderModule = std::shared_ptr<inner::ShaderModule>;
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "hash.h"
+
+struct BlendState
+{
+    public:
+    bool enable = true;
+    vk::BlendFactor src_color = vk::BlendFactor::eSrcAlpha;
+    vk::BlendFactor dst_color = vk::BlendFactor::eOneMinusSrcAlpha;
+    vk::BlendOp color_op = vk::BlendOp::eAdd;
+    vk::BlendFactor src_alpha = vk::BlendFactor::eOne;
+    vk::BlendFactor dst_alpha = vk::BlendFactor::eZero;
+    vk::BlendOp alpha_op = vk::BlendOp::eAdd;
+    vk::ColorComponentFlags write_mask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+
+    static auto Opaque()
+    {
+        BlendState state;
+        state.enable = false;
+        return state;
+    }
+
+    auto Attachment() const
+    {
+        return vk::PipelineColorBlendAttachmentState()
+            .setColorWriteMask(write_mask)
+            .setBlendEnable(enable)
+            .setSrcColorBlendFactor(src_color)
+            .setDstColorBlendFactor(dst_color)
+            .setColorBlendOp(color_op)
+            .setSrcAlphaBlendFactor(src_alpha)
+            .setDstAlphaBlendFactor(dst_alpha)
+            .setAlphaBlendOp(alpha_op);
+    }
+
+    void Hash(Hasher& hasher) const
+    {
+        hasher.Add(enable).Add(write_mask);
+        if (enable)
+        {
+            hasher.Add(src_color).Add(dst_color).Add(color_op).Add(src_alpha).Add(dst_alpha).Add(alpha_op);
+        }
+    }
+};
+
+// Every piece of fixed function state a graphics pipeline is created with. The defaults match what
+// GraphicsPipelineBuilder has always used: triangle lists, back face culling, alpha blending and no depth test.
+struct GraphicsPipelineState
+{
+    public:
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    bool primitive_restart = false;
+
+    vk::PolygonMode polygon_mode = vk::PolygonMode::eFill;
+    vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eBack;
+    vk::FrontFace front_face = vk::FrontFace::eClockwise;
+    bool depth_clamp = false;
+    bool rasterizer_discard = false;
+    bool depth_bias = false;
+    float depth_bias_constant = 0.0f;
+    float depth_bias_clamp = 0.0f;
+    float depth_bias_slope = 0.0f;
+    float line_width = 1.0f;
+
+    bool depth_test = false;
+    bool depth_write = false;
+    vk::CompareOp depth_compare = vk::CompareOp::eGreater;
+    bool stencil_test = false;
+    vk::StencilOpState stencil_front = vk::StencilOpState().setCompareOp(vk::CompareOp::eAlways);
+    vk::StencilOpState stencil_back = vk::StencilOpState().setCompareOp(vk::CompareOp::eAlways);
+
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    bool sample_shading = false;
+    float min_sample_shading = 0.0f;
+    bool alpha_to_coverage = false;
+
+    // One entry per color attachment, when empty every attachment gets the default BlendState.
+    std::vector<BlendState> blends;
+    bool logic_op_enable = false;
+    vk::LogicOp logic_op = vk::LogicOp::eCopy;
+    std::array<float, 4> blend_constants = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    // Fields that have no effect (compare op with the depth test off, bias factors with bias off...) are left
+    // out, so states that behave the same hash the same. The parts follow the graphics pipeline library split.
+    void Hash(Hasher& hasher, uint32_t colorblend_count) const
+    {
+        HashVertexInput(hasher);
+        HashPreRasterization(hasher);
+        HashFragmentShader(hasher);
+        HashFragmentOutput(hasher, colorblend_count);
+    }
+
+    void HashVertexInput(Hasher& hasher) const
+    {
+        hasher.Add(topology).Add(primitive_restart);
+    }
+
+    void HashPreRasterization(Hasher& hasher) const
+    {
+        hasher.Add(polygon_mode).Add(cull_mode).Add(front_face).Add(depth_clamp).Add(rasterizer_discard).Add(line_width);
+        hasher.Add(depth_bias);
+        if (depth_bias)
+        {
+            hasher.Add(depth_bias_constant).Add(depth_bias_clamp).Add(depth_bias_slope);
+        }
+    }
+
+    void HashFragmentShader(Hasher& hasher) const
+    {
+        hasher.Add(depth_test).Add(depth_write);
+        if (depth_test)
+        {
+            hasher.Add(depth_compare);
+        }
+        hasher.Add(stencil_test);
+        if (stencil_test)
+        {
+            for (auto& s : {stencil_front, stencil_back})
+            {
+                hasher.Add(s.failOp).Add(s.passOp).Add(s.depthFailOp).Add(s.compareOp).Add(s.compareMask).Add(s.writeMask).Add(s.reference);
+            }
+        }
+        hasher.Add(samples).Add(sample_shading);
+        if (sample_shading)
+        {
+            hasher.Add(min_sample_shading);
+        }
+    }
+
+    void HashFragmentOutput(Hasher& hasher, uint32_t colorblend_count) const
+    {
+        hasher.Add(samples).Add(alpha_to_coverage);
+        hasher.Add(colorblend_count);
+        for (uint32_t x = 0; x < colorblend_count; x++)
+        {
+            Blend(x).Hash(hasher);
+        }
+        hasher.Add(logic_op_enable);
+        if (logic_op_enable)
+        {
+            hasher.Add(logic_op);
+        }
+        for (auto constant : blend_constants)
+        {
+            hasher.Add(constant);
+        }
+    }
+
+    uint64_t Hash(uint32_t colorblend_count) const
+    {
+        Hasher hasher;
+        Hash(hasher, colorblend_count);
+        return hasher.Get();
+    }
+
+    BlendState Blend(uint32_t attachment) const
+    {
+        return attachment < blends.size() ? blends.at(attachment) : BlendState();
+    }
+};
+
+// The part of GraphicsPipelineState a command buffer can change between draws. Pipelines built with
+// SetDynamicState take these from the command buffer: through VK_EXT_extended_dynamic_state(2) when the
+// device has it, otherwise by switching to a pipeline permutation baked with the requested values.
+// The dynamic topology has to stay in the same class (point, line, triangle, patch) as the baked one.
+struct DynamicState
+{
+    public:
+    // VK_EXT_extended_dynamic_state
+    vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eBack;
+    vk::FrontFace front_face = vk::FrontFace::eClockwise;
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    bool depth_test = false;
+    bool depth_write = false;
+    vk::CompareOp depth_compare = vk::CompareOp::eGreater;
+    bool stencil_test = false;
+
+    // VK_EXT_extended_dynamic_state2
+    bool rasterizer_discard = false;
+    bool depth_bias = false;
+    bool primitive_restart = false;
+
+    static auto From(const GraphicsPipelineState& state)
+    {
+        DynamicState dynamic;
+        dynamic.cull_mode = state.cull_mode;
+        dynamic.front_face = state.front_face;
+        dynamic.topology = state.topology;
+        dynamic.depth_test = state.depth_test;
+        dynamic.depth_write = state.depth_write;
+        dynamic.depth_compare = state.depth_compare;
+        dynamic.stencil_test = state.stencil_test;
+        dynamic.rasterizer_discard = state.rasterizer_discard;
+        dynamic.depth_bias = state.depth_bias;
+        dynamic.primitive_restart = state.primitive_restart;
+        return dynamic;
+    }
+
+    void Apply(GraphicsPipelineState& state) const
+    {
+        state.cull_mode = cull_mode;
+        state.front_face = front_face;
+        state.topology = topology;
+        state.depth_test = depth_test;
+        state.depth_write = depth_write;
+        state.depth_compare = depth_compare;
+        state.stencil_test = stencil_test;
+        state.rasterizer_discard = rasterizer_discard;
+        state.depth_bias = depth_bias;
+        state.primitive_restart = primitive_restart;
+    }
+
+    // Only the groups a pipeline bakes in pick its permutation, the others are set on the command buffer.
+    void Hash(Hasher& hasher, bool extended, bool extended2) const
+    {
+        if (extended)
+        {
+            hasher.Add(cull_mode).Add(front_face).Add(topology).Add(depth_test).Add(depth_write).Add(depth_compare).Add(stencil_test);
+        }
+        if (extended2)
+        {
+            hasher.Add(rasterizer_discard).Add(depth_bias).Add(primitive_restart);
+        }
+    }
+
+    // Compares the same groups Hash covers.
+    bool Matches(const DynamicState& other, bool extended, bool extended2) const
+    {
+        if (extended && (cull_mode != other.cull_mode || front_face != other.front_face || topology != other.topology ||
+            depth_test != other.depth_test || depth_write != other.depth_write || depth_compare != other.depth_compare ||
+            stencil_test != other.stencil_test))
+        {
+            return false;
+        }
+        if (extended2 && (rasterizer_discard != other.rasterizer_discard || depth_bias != other.depth_bias ||
+            primitive_restart != other.primitive_restart))
+        {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Values for a shader's specialization constants, by constant_id.
+class SpecializationConstants
+{
+    private:
+    std::vector<vk::SpecializationMapEntry> m_Entries;
+    std::vector<uint8_t> m_Data;
+
+    public:
+    template <typename T>
+    auto Set(uint32_t id, T value) requires std::is_trivially_copyable_v<T>
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return Set(id, vk::Bool32(value));
+        }
+        else
+        {
+            auto entry = std::find_if(m_Entries.begin(), m_Entries.end(), [&](auto& e) { return e.constantID == id; });
+            if (entry != m_Entries.end() && entry->size == sizeof(T))
+            {
+                std::memcpy(m_Data.data() + entry->offset, &value, sizeof(T));
+                return *this;
+            }
+            if (entry != m_Entries.end())
+            {
+                m_Entries.erase(entry);
+            }
+            m_Entries.emplace_back(id, static_cast<uint32_t>(m_Data.size()), sizeof(T));
+            m_Data.resize(m_Data.size() + sizeof(T));
+            std::memcpy(m_Data.data() + m_Entries.back().offset, &value, sizeof(T));
+            return *this;
+        }
+    }
+
+    auto Empty() const
+    {
+        return m_Entries.empty();
+    }
+
+    // Points into this object, which has to outlive the pipeline creation call.
+    auto Info() const
+    {
+        return vk::SpecializationInfo()
+            .setMapEntries(m_Entries)
+            .setDataSize(m_Data.size())
+            .setPData(m_Data.data());
+    }
+
+    void Hash(Hasher& hasher) const
+    {
+        auto entries = m_Entries;
+        std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.constantID < b.constantID; });
+        hasher.Add(entries.size());
+        for (auto& entry : entries)
+        {
+            hasher.Add(entry.constantID).Add(entry.size);
+            for (size_t x = 0; x < entry.size; x++)
+            {
+                hasher.Add(m_Data[entry.offset + x]);
+            }
+        }
+    }
+
+    HashKey Key() const
+    {
+        Hasher hasher;
+        Hash(hasher);
+        return hasher.Key();
+    }
+};
+
+namespace inner
+{
+    class Pipeline;
+
+    // Device wide lookup from a pipeline's full description to the live pipeline, entries expire with the pipeline.
+    class PipelineRegistry
+    {
+        private:
+        std::mutex mutex;
+        std::unordered_map<HashKey, std::weak_ptr<Pipeline>> pipelines;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        public:
+        std::shared_ptr<Pipeline> Find(const HashKey& key)
+        {
+            std::lock_guard lock(mutex);
+            auto entry = pipelines.find(key);
+            if (entry != pipelines.end())
+            {
+                if (auto pipeline = entry->second.lock())
+                {
+                    hits++;
+                    return pipeline;
+                }
+                pipelines.erase(entry);
+            }
+            return nullptr;
+        }
+
+        // Creation happens outside the lock. If two threads race on the same key the first insert wins
+        // and the other thread's pipeline is dropped.
+        std::shared_ptr<Pipeline> GetOrCreate(const HashKey& key, const std::function<std::shared_ptr<Pipeline>()>& create)
+        {
+            if (auto pipeline = Find(key))
+            {
+                return pipeline;
+            }
+            auto created = create();
+
+            std::lock_guard lock(mutex);
+            auto& entry = pipelines[key];
+            if (auto existing = entry.lock())
+            {
+                hits++;
+                return existing;
+            }
+            misses++;
+            entry = created;
+            return created;
+        }
+
+        auto GetStats()
+        {
+            std::lock_guard lock(mutex);
+            return std::pair(hits, misses);
+        }
+    };
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#include "device.h"
+
+// Collects waits, signals and command buffers for one vkQueueSubmit. Every submit also signals the queue's
+// timeline and returns the token for it, which other queues and the CPU can wait on.
+class SubmitBuilder
+{
+    private:
+    std::vector<vk::Semaphore> m_Waits;
+    std::vector<uint64_t> m_WaitValues;
+    std::vector<vk::PipelineStageFlags> m_WaitStages;
+    std::vector<SyncToken> m_Tokens;
+    std::vector<vk::Semaphore> m_Signals;
+    std::vector<vk::CommandBuffer> m_CommandBuffers;
+    public:
+    auto AddWait(vk::Semaphore binary, vk::PipelineStageFlags stage)
+    {
+        m_Waits.push_back(binary);
+        m_WaitValues.push_back(0);
+        m_WaitStages.push_back(stage);
+        return *this;
+    }
+
+    // Tokens without a timeline (default constructed, nothing to wait for) are skipped.
+    auto AddWait(SyncToken token, vk::PipelineStageFlags stage)
+    {
+        if (token.timeline)
+        {
+            m_Waits.push_back(token.timeline->Semaphore());
+            m_WaitValues.push_back(token.value);
+            m_WaitStages.push_back(stage);
+            m_Tokens.push_back(token);
+        }
+        return *this;
+    }
+
+    auto AddSignal(vk::Semaphore binary)
+    {
+        m_Signals.push_back(binary);
+        return *this;
+    }
+
+    auto AddCommandBuffer(vk::CommandBuffer buffer)
+    {
+        m_CommandBuffers.push_back(buffer);
+        return *this;
+    }
+
+    SyncToken Submit(Queue queue, vk::Fence fence = {})
+    {
+        auto timeline = queue.Timeline();
+        auto value = timeline->Submit([&](vk::Semaphore semaphore, uint64_t value) {
+            auto signals = m_Signals;
+            std::vector<uint64_t> signal_values(signals.size(), 0);
+            signals.push_back(semaphore);
+            signal_values.push_back(value);
+
+            auto timeline_info = vk::TimelineSemaphoreSubmitInfo()
+                .setWaitSemaphoreValues(m_WaitValues)
+                .setSignalSemaphoreValues(signal_values);
+            auto info = vk::SubmitInfo()
+                .setPNext(&timeline_info)
+                .setWaitSemaphores(m_Waits)
+                .setWaitDstStageMask(m_WaitStages)
+                .setCommandBuffers(m_CommandBuffers)
+                .setSignalSemaphores(signals);
+            queue.submit(info, fence);
+        });
+        return SyncToken{timeline, value};
+    }
+};
@@ -1,5 +1,30 @@
 #pragma once
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+
 #include "device.h"
+#include "submit.h"
+
+enum class LatencyPolicy
+{
+    // Waits for the frame FramesInFlight() back, keeping the GPU fed at the cost of input latency.
+    THROUGHPUT,
+    // Waits for the previous frame to finish right before input is sampled, the CPU never runs ahead of the GPU.
+    LOW_LATENCY,
+};
+
+// Timing of one frame, measured from the end of WaitFrame, which is where input should be sampled.
+struct FrameLatency
+{
+    public:
+    uint64_t frame = 0;
+    // Until Present was called.
+    double cpu_ms = 0.0;
+    // Until the GPU finished the frame's work. Completion is polled at WaitFrame and Present, so it may overshoot by one poll.
+    double present_ms = 0.0;
+};
 
 namespace inner
 {
@@ -14,13 +39,65 @@ namespace inner
         vk::Extent2D m_Size;
         std::vector<vk::UniqueImageView> m_ImageViews;    
         std::shared_ptr<Device> device;
+        // Acquire semaphores belong to a frame slot, present semaphores to an image since presentation finishing with
+        // one is only known once the image is acquired again. Completion is tracked on the present queue's timeline.
         std::vector<vk::UniqueSemaphore> m_AquireSemaphores;
         std::vector<vk::UniqueSemaphore> m_PresentSemaphores;
-        std::vector<vk::UniqueFence> m_SubmitFences;
-        vk::Queue m_PresentQueue;
-        uint32_t m_AquireIndex;
+        std::vector<uint64_t> m_FrameValues;
+        std::vector<uint64_t> m_ImageValues;
+        Queue m_PresentQueue;
+        uint32_t m_FramesInFlight;
+        uint64_t m_Frame = 0;
+        uint64_t m_LastValue = 0;
+        LatencyPolicy m_Policy;
+        bool m_Waited = false;
         uint32_t image_index;
 
+        using Clock = std::chrono::steady_clock;
+        struct Pending
+        {
+            uint64_t frame;
+            uint64_t value;
+            Clock::time_point start;
+            Clock::time_point presented;
+        };
+        Clock::time_point m_FrameStart;
+        std::deque<Pending> m_Pending;
+        FrameLatency m_Latency;
+        // Frames whose GPU work is known to have finished.
+        uint64_t m_Finished = 0;
+
+        // A replaced swapchain with its views and present semaphores. Presents are not on the timeline, so they are
+        // only known to be done once a frame presented on the new swapchain was followed by one that finished.
+        struct Retired
+        {
+            uint64_t frame;
+            std::function<void()> destroy;
+        };
+        std::deque<Retired> m_Retired;
+
+        void Observe()
+        {
+            if (m_Pending.empty())
+                return;
+            auto completed = m_PresentQueue.Timeline()->Completed();
+            auto now = Clock::now();
+            while (!m_Pending.empty() && m_Pending.front().value <= completed)
+            {
+                auto& pending = m_Pending.front();
+                m_Latency.frame = pending.frame;
+                m_Latency.cpu_ms = std::chrono::duration<double, std::milli>(pending.presented - pending.start).count();
+                m_Latency.present_ms = std::chrono::duration<double, std::milli>(now - pending.start).count();
+                m_Finished = pending.frame + 1;
+                m_Pending.pop_front();
+            }
+            while (!m_Retired.empty() && m_Finished > m_Retired.front().frame + 1)
+            {
+                device->GetDeletionQueue().Push(std::move(m_Retired.front().destroy));
+                m_Retired.pop_front();
+            }
+        }
+
         auto CreateSwapchainImageViews()
         {
             auto images = device->getSwapchainImagesKHR(swapchain);
@@ -46,10 +123,37 @@ namespace inner
                 );
             }
         }
+        // Holds the swapchain, the current image views and present semaphores back until Observe hands them to the
+        // deletion queue. The surface is kept alive until then since the swapchain has to be destroyed first.
+        void Retire(vk::SwapchainKHR old)
+        {
+            std::vector<vk::ImageView> views;
+            for (auto& view : m_ImageViews)
+            {
+                views.push_back(view.release());
+            }
+            std::vector<vk::Semaphore> semaphores;
+            for (auto& semaphore : m_PresentSemaphores)
+            {
+                semaphores.push_back(semaphore.release());
+            }
+            m_ImageViews.clear();
+            m_PresentSemaphores.clear();
+
+            vk::Device handle = *device;
+            m_Retired.push_back({m_Frame, [handle, old, views, semaphores, surface = surface]() {
+                for (auto view : views)
+                    handle.destroyImageView(view);
+                for (auto semaphore : semaphores)
+                    handle.destroySemaphore(semaphore);
+                handle.destroySwapchainKHR(old);
+            }});
+        }
+
         public:
     
         Swapchain(std::shared_ptr<Device> device, vk::SurfaceFormatKHR surface_format, vk::PresentModeKHR present_mode, uint32_t image_count, 
-        std::shared_ptr<Surface> surface, vk::Queue present_queue, vk::Extent2D size):
+        std::shared_ptr<Surface> surface, Queue present_queue, vk::Extent2D size, uint32_t frames_in_flight, LatencyPolicy policy):
         device(device),
         m_SurfaceFormat(surface_format),
         m_PresentMode(present_mode),
@@ -57,38 +161,96 @@ namespace inner
         surface(surface),
         m_PresentQueue(present_queue),
         m_Size(size),
-        m_AquireIndex(0)
+        m_FramesInFlight(frames_in_flight),
+        m_FrameValues(frames_in_flight, 0),
+        m_Policy(policy)
         {
             RecreateSwapchain(m_Size);
-            for(int x = 0; x < m_ImageViews.size(); x++)
+            for(uint32_t x = 0; x < m_FramesInFlight; x++)
             {
-                m_AquireSemaphores.emplace_back( device->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
-
-                m_PresentSemaphores.emplace_back(device->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
-                m_SubmitFences.emplace_back(device->createFenceUnique(vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled)));
+                m_AquireSemaphores.emplace_back(device->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
             }
         }
 
         ~Swapchain()
         {
-            device->destroySwapchainKHR(swapchain);
+            for (auto& semaphore : m_AquireSemaphores)
+            {
+                device->Retire(semaphore.release());
+            }
+            Retire(swapchain);
+            // No later frame will come, waiting on the queue covers its presents as well.
+            m_PresentQueue.WaitIdle();
+            for (auto& retired : m_Retired)
+            {
+                device->GetDeletionQueue().Push(std::move(retired.destroy));
+            }
+        }
+
+        // Blocks until the frame's latency budget allows another frame to start. Call it right before sampling input,
+        // AquireNextImage calls it itself when it was not called for this frame.
+        void WaitFrame()
+        {
+            if (m_Waited)
+                return;
+            auto timeline = m_PresentQueue.Timeline();
+            auto value = m_Policy == LatencyPolicy::LOW_LATENCY ? m_LastValue : m_FrameValues[Frame()];
+            if (timeline->Completed() < value)
+            {
+                timeline->Wait(value);
+            }
+            Observe();
+            m_FrameStart = Clock::now();
+            m_Waited = true;
         }
 
+        // Waits through WaitFrame and, rarely, for the acquired image when a submission further back still uses it.
         auto AquireNextImage() //todo: handle failure
         {
-            vk::Semaphore sem = m_AquireSemaphores.at(m_AquireIndex).get();
+            WaitFrame();
+            auto timeline = m_PresentQueue.Timeline();
+            auto slot = Frame();
+
+            vk::Semaphore sem = m_AquireSemaphores.at(slot).get();
             image_index = device->acquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(), sem, nullptr);
-            m_AquireIndex = (m_AquireIndex + 1) % m_ImageViews.size();
 
-            device->waitForFences(m_SubmitFences.at(image_index).get(), true, std::numeric_limits<uint64_t>::max());
-            device->resetFences(m_SubmitFences.at(image_index).get());
+            if (timeline->Completed() < m_ImageValues.at(image_index))
+            {
+                timeline->Wait(m_ImageValues.at(image_index));
+            }
+
+            return std::tuple(image_index, sem, m_PresentSemaphores.at(image_index).get());
+        }
+
+        // Submits the frame's work waiting on the acquire semaphore at stage and signalling the present semaphore,
+        // the returned token is the point on the present queue's timeline where this frame is done.
+        SyncToken Submit(SubmitBuilder submit, vk::PipelineStageFlags stage = vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        {
+            auto slot = Frame();
+            auto token = submit
+                .AddWait(m_AquireSemaphores.at(slot).get(), stage)
+                .AddSignal(m_PresentSemaphores.at(image_index).get())
+                .Submit(m_PresentQueue);
+            m_FrameValues[slot] = token.value;
+            m_ImageValues.at(image_index) = token.value;
+            m_LastValue = token.value;
+            return token;
+        }
+
+        // Slot of the current frame in [0, FramesInFlight()), for per-frame resources such as FrameAllocator partitions.
+        uint32_t Frame()
+        {
+            return static_cast<uint32_t>(m_Frame % m_FramesInFlight);
+        }
 
-            return std::tuple(image_index, sem, m_PresentSemaphores.at(image_index).get(), m_SubmitFences.at(image_index).get());
+        auto FramesInFlight()
+        {
+            return m_FramesInFlight;
         }
 
         auto Present() // todo: handle failure
         {
-            m_PresentQueue.presentKHR(
+            m_PresentQueue.Present(
                 vk::PresentInfoKHR()
                 .setWaitSemaphoreCount(1)
                 .setPWaitSemaphores(&m_PresentSemaphores.at(image_index).get())
@@ -96,6 +258,26 @@ namespace inner
                 .setPSwapchains(&swapchain)
                 .setPImageIndices(&image_index)
             );
+            m_Pending.push_back({m_Frame, m_FrameValues[Frame()], m_FrameStart, Clock::now()});
+            m_Frame++;
+            m_Waited = false;
+            Observe();
+        }
+
+        // Latest frame whose GPU work is known to have finished.
+        auto GetFrameLatency()
+        {
+            return m_Latency;
+        }
+
+        auto GetPresentMode()
+        {
+            return m_PresentMode;
+        }
+
+        auto GetLatencyPolicy()
+        {
+            return m_Policy;
         }
 
         auto GetSize()
@@ -140,9 +322,21 @@ namespace inner
 
             swapchain = device->createSwapchainKHR(cinfo);
 
-            device->destroySwapchainKHR(tmp);
+            // The old swapchain, its views and the present semaphores can still be in use by frames already submitted
+            // or presented, so they are retired instead of being destroyed here. Nothing waits on the GPU.
+            if (tmp)
+            {
+                Retire(tmp);
+            }
 
             CreateSwapchainImageViews();
+
+            for (size_t x = 0; x < m_ImageViews.size(); x++)
+            {
+                m_PresentSemaphores.emplace_back(device->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
+            }
+            // No submission has used the new images yet.
+            m_ImageValues.assign(m_ImageViews.size(), 0);
         }
     };
 };
@@ -155,6 +349,8 @@ class SwapchainBuilder
     vk::SurfaceFormatKHR m_SurfaceFormat = vk::SurfaceFormatKHR(vk::Format::eB8G8R8A8Srgb, vk::ColorSpaceKHR::eSrgbNonlinear);
     vk::PresentModeKHR m_PresentMode = vk::PresentModeKHR::eFifo;
     uint32_t m_RequestedImages = 3;
+    uint32_t m_FramesInFlight = 2;
+    LatencyPolicy m_Policy = LatencyPolicy::THROUGHPUT;
     public:
     SwapchainBuilder()
     {}
@@ -174,7 +370,20 @@ class SwapchainBuilder
         m_RequestedImages = images;
         return *this;
     }
-    auto Build(Device device, Surface surface, vk::Queue present_queue, vk::Extent2D size)
+    // How many frames the CPU may record ahead of the GPU, independent of the number of swapchain images. At least 1.
+    auto SetFramesInFlight(uint32_t frames = 2)
+    {
+        m_FramesInFlight = frames;
+        return *this;
+    }
+    auto SetLatencyPolicy(LatencyPolicy policy)
+    {
+        m_Policy = policy;
+        return *this;
+    }
+    // An unsupported present mode falls back along mailbox, immediate, fifo_relaxed, fifo, starting after the
+    // requested mode when it is part of that chain. Fifo is always supported.
+    auto Build(Device device, Surface surface, Queue present_queue, vk::Extent2D size)
     {
         auto physical = device->physical();
         auto surfaceFormats = physical.getSurfaceFormatsKHR(*surface);
@@ -186,13 +395,24 @@ class SwapchainBuilder
         if(!supported)
             throw(std::exception("Surface format not supported"));
 
-        supported = false;
-        for(auto mode : physical.getSurfacePresentModesKHR(*surface))
-            if(mode == m_PresentMode)
-                {supported = true; break;}
-
-        if(!supported)
-            throw(std::exception("Present mode not supported"));
+        const std::array<vk::PresentModeKHR, 4> fallback = {vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eFifoRelaxed, vk::PresentModeKHR::eFifo};
+        auto modes = physical.getSurfacePresentModesKHR(*surface);
+        auto present_mode = m_PresentMode;
+        if (std::find(modes.begin(), modes.end(), present_mode) == modes.end())
+        {
+            auto next = std::find(fallback.begin(), fallback.end(), present_mode);
+            next = next == fallback.end() ? fallback.begin() : next + 1;
+            present_mode = vk::PresentModeKHR::eFifo;
+            for (; next != fallback.end(); next++)
+            {
+                if (std::find(modes.begin(), modes.end(), *next) != modes.end())
+                {
+                    present_mode = *next;
+                    break;
+                }
+            }
+            warn("Present mode " + vk::to_string(m_PresentMode) + " not supported, using " + vk::to_string(present_mode));
+        }
         
         auto capabilities = physical.getSurfaceCapabilitiesKHR(*surface);
 
@@ -205,6 +425,6 @@ class SwapchainBuilder
         size.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, size.height));
 
 
-        return std::make_shared<inner::Swapchain>(device, m_SurfaceFormat, m_PresentMode, image_count, surface, present_queue, size);
+        return std::make_shared<inner::Swapchain>(device, m_SurfaceFormat, present_mode, image_count, surface, present_queue, size, std::max(m_FramesInFlight, 1u), m_Policy);
     }
 };
\ No newline at end of file
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+#include "pool.h"
+#include "memory.h"
+#include "submit.h"
+
+struct UploadStats
+{
+    public:
+    uint64_t uploads = 0;
+    uint64_t bytes = 0;
+    uint64_t submits = 0;
+    // Time from Upload until the copy was seen completed, summed over all retired uploads.
+    double latency = 0.0;
+    // Time spent waiting for the transfer queue because the staging ring was full.
+    double stalls = 0.0;
+    uint64_t retired = 0;
+
+    auto AverageLatency()
+    {
+        return retired ? latency / retired : 0.0;
+    }
+};
+
+namespace inner
+{
+    // Copies data to device local buffers and images through a persistently mapped staging ring on the transfer
+    // queue. Uploads are batched into one submit until Flush, or until a token for them is requested. When the
+    // transfer family differs from the graphics family, resources are released to the graphics family and the
+    // matching acquire barriers are recorded by Acquire on the graphics side.
+    class UploadManager
+    {
+        private:
+        using Clock = std::chrono::steady_clock;
+        struct Batch
+        {
+            uint64_t id = 0;
+            uint64_t value = 0;
+            vk::DeviceSize end = 0;
+            std::shared_ptr<CommandBuffer> buffer;
+            std::vector<vk::BufferMemoryBarrier> buffer_releases;
+            std::vector<vk::ImageMemoryBarrier> image_releases;
+            uint32_t uploads = 0;
+            double requested = 0.0;
+        };
+
+        Queue transfer;
+        uint32_t graphics_family;
+        std::shared_ptr<CommandPool> pool;
+
+        std::shared_ptr<Buffer> staging;
+        uint8_t* mapped = nullptr;
+        vk::DeviceSize capacity;
+        vk::DeviceSize alignment;
+        vk::DeviceSize head = 0;
+        vk::DeviceSize tail = 0;
+        bool wrapped = false;
+
+        Batch open;
+        uint64_t next_id = 1;
+        std::deque<Batch> in_flight;
+        std::vector<std::shared_ptr<CommandBuffer>> free_buffers;
+        std::vector<vk::BufferMemoryBarrier> buffer_acquires;
+        std::vector<vk::ImageMemoryBarrier> image_acquires;
+        uint64_t last_flushed = 0;
+        std::mutex mutex;
+        UploadStats stats;
+
+        static double Now()
+        {
+            return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+        }
+
+        bool Transfers()
+        {
+            return transfer.Family() != graphics_family;
+        }
+
+        void Retire()
+        {
+            auto completed = transfer.Timeline()->Completed();
+            auto now = Now();
+            while (!in_flight.empty() && in_flight.front().value <= completed)
+            {
+                auto& done = in_flight.front();
+                // A batch ending before the current tail lies in the wrapped part, everything before the wrap is free now.
+                if (done.end < tail)
+                    wrapped = false;
+                tail = done.end;
+                free_buffers.push_back(done.buffer);
+                stats.latency += done.uploads * now - done.requested;
+                stats.retired += done.uploads;
+                in_flight.pop_front();
+            }
+            if (in_flight.empty() && !open.buffer)
+            {
+                head = tail = 0;
+                wrapped = false;
+            }
+        }
+
+        std::optional<vk::DeviceSize> TryAllocate(vk::DeviceSize size)
+        {
+            auto offset = (head + alignment - 1) / alignment * alignment;
+            if (!wrapped)
+            {
+                if (offset + size <= capacity)
+                {
+                    head = offset + size;
+                    return offset;
+                }
+                if (size <= tail)
+                {
+                    wrapped = true;
+                    head = size;
+                    return 0;
+                }
+                return std::nullopt;
+            }
+            if (offset + size <= tail)
+            {
+                head = offset + size;
+                return offset;
+            }
+            return std::nullopt;
+        }
+
+        // Waits on the transfer timeline, never on the device, when the ring has no room left.
+        vk::DeviceSize Allocate(vk::DeviceSize size)
+        {
+            while (true)
+            {
+                Retire();
+                if (auto offset = TryAllocate(size))
+                {
+                    return *offset;
+                }
+                if (open.buffer)
+                {
+                    Submit();
+                    continue;
+                }
+                if (in_flight.empty())
+                {
+                    throw(std::exception("Upload does not fit in the staging ring"));
+                }
+                auto start = Now();
+                transfer.Timeline()->Wait(in_flight.front().value);
+                stats.stalls += Now() - start;
+            }
+        }
+
+        CommandBuffer& Recording()
+        {
+            if (!open.buffer)
+            {
+                if (!free_buffers.empty())
+                {
+                    open.buffer = free_buffers.back();
+                    free_buffers.pop_back();
+                }
+                else
+                {
+                    open.buffer = std::make_shared<CommandBuffer>(
+                        transfer.Device()->allocateCommandBuffers(
+                            vk::CommandBufferAllocateInfo()
+                                .setCommandPool(*pool)
+                                .setCommandBufferCount(1)
+                                .setLevel(vk::CommandBufferLevel::ePrimary)
+                        ).front(), *pool);
+                }
+                open.id = next_id++;
+                open.buffer->begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            }
+            return *open.buffer;
+        }
+
+        // Counted in the batch that holds the last part of the upload.
+        void Track()
+        {
+            open.uploads++;
+            open.requested += Now();
+            stats.uploads++;
+        }
+
+        SyncToken Submit()
+        {
+            if (!open.buffer)
+            {
+                return SyncToken{transfer.Timeline(), last_flushed};
+            }
+            auto& buffer = *open.buffer;
+            if (!open.buffer_releases.empty() || !open.image_releases.empty())
+            {
+                buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, open.buffer_releases, open.image_releases);
+            }
+            buffer.end();
+
+            auto token = SubmitBuilder()
+                .AddCommandBuffer(buffer)
+                .Submit(transfer);
+            stats.submits++;
+            last_flushed = token.value;
+
+            open.value = token.value;
+            open.end = head;
+            for (auto barrier : open.buffer_releases)
+            {
+                buffer_acquires.push_back(barrier.setSrcAccessMask({}).setDstAccessMask(vk::AccessFlagBits::eMemoryRead));
+            }
+            for (auto barrier : open.image_releases)
+            {
+                image_acquires.push_back(barrier.setSrcAccessMask({}).setDstAccessMask(vk::AccessFlagBits::eMemoryRead));
+            }
+            in_flight.push_back(std::move(open));
+            open = Batch();
+            return token;
+        }
+
+        public:
+        UploadManager(Queue transfer, uint32_t graphics_family, std::shared_ptr<CommandPool> pool, vk::DeviceSize capacity):
+        transfer(transfer), graphics_family(graphics_family), pool(pool), capacity(capacity)
+        {
+            auto device = transfer.Device();
+            alignment = std::max<vk::DeviceSize>(16, device->physical().getProperties().limits.optimalBufferCopyOffsetAlignment);
+            staging = BufferBuilder()
+                .SetSize(capacity)
+                .SetUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                .SetMemoryUsage(MemoryUsage::CPU_ONLY)
+                .Build(device);
+            mapped = staging->Mapped();
+        }
+
+        ~UploadManager()
+        {
+            transfer.Timeline()->Wait(transfer.Timeline()->Last());
+        }
+
+        // Returns the batch the copy went into, larger buffers are split over several batches and return the last one.
+        uint64_t Upload(vk::Buffer destination, vk::DeviceSize destination_offset, const void* data, vk::DeviceSize size)
+        {
+            std::lock_guard lock(mutex);
+            auto source = static_cast<const uint8_t*>(data);
+            for (vk::DeviceSize done = 0; done < size;)
+            {
+                auto chunk = std::min(size - done, capacity / 2);
+                auto offset = Allocate(chunk);
+                std::memcpy(mapped + offset, source + done, chunk);
+                Recording().copyBuffer(*staging, destination, vk::BufferCopy(offset, destination_offset + done, chunk));
+                done += chunk;
+            }
+            if (Transfers())
+            {
+                open.buffer_releases.push_back(
+                    vk::BufferMemoryBarrier()
+                        .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                        .setSrcQueueFamilyIndex(transfer.Family())
+                        .setDstQueueFamilyIndex(graphics_family)
+                        .setBuffer(destination)
+                        .setOffset(destination_offset)
+                        .setSize(size)
+                );
+            }
+            Track();
+            stats.bytes += size;
+            return open.id;
+        }
+
+        // Replaces the contents of one subresource region and leaves the image in layout. current is the layout the
+        // subresource is in when the batch runs. eUndefined discards the rest of the subresource, which is only right
+        // when the region covers it. Anything else keeps it and waits for earlier writes on the queue, which is only
+        // possible when uploads run on the graphics family: on a separate transfer family the image would first have
+        // to be released by the graphics queue, which nothing here records.
+        uint64_t Upload(vk::Image destination, vk::ImageLayout current, vk::ImageLayout layout, vk::BufferImageCopy region, const void* data, vk::DeviceSize size)
+        {
+            std::lock_guard lock(mutex);
+            if (size > capacity)
+            {
+                throw(std::exception("Image upload does not fit in the staging ring"));
+            }
+            if (current != vk::ImageLayout::eUndefined && Transfers())
+            {
+                throw(std::exception("Partial image uploads need the graphics family, the transfer queue cannot keep contents it does not own"));
+            }
+            auto offset = Allocate(size);
+            std::memcpy(mapped + offset, data, size);
+            region.setBufferOffset(offset);
+
+            auto range = vk::ImageSubresourceRange()
+                .setAspectMask(region.imageSubresource.aspectMask)
+                .setBaseMipLevel(region.imageSubresource.mipLevel)
+                .setLevelCount(1)
+                .setBaseArrayLayer(region.imageSubresource.baseArrayLayer)
+                .setLayerCount(region.imageSubresource.layerCount);
+            auto& buffer = Recording();
+            auto discard = current == vk::ImageLayout::eUndefined;
+            buffer.pipelineBarrier(discard ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                vk::ImageMemoryBarrier()
+                    .setSrcAccessMask(discard ? vk::AccessFlags() : vk::AccessFlagBits::eMemoryWrite)
+                    .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                    .setOldLayout(current)
+                    .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                    .setImage(destination)
+                    .setSubresourceRange(range)
+            );
+            buffer.copyBufferToImage(*staging, destination, vk::ImageLayout::eTransferDstOptimal, region);
+
+            auto release = vk::ImageMemoryBarrier()
+                .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+                .setNewLayout(layout)
+                .setImage(destination)
+                .setSubresourceRange(range);
+            if (Transfers())
+            {
+                open.image_releases.push_back(release.setSrcQueueFamilyIndex(transfer.Family()).setDstQueueFamilyIndex(graphics_family));
+            }
+            else
+            {
+                buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {}, release);
+            }
+            Track();
+            stats.bytes += size;
+            return open.id;
+        }
+
+        // Submits everything uploaded so far as one batch.
+        SyncToken Flush()
+        {
+            std::lock_guard lock(mutex);
+            Retire();
+            return Submit();
+        }
+
+        // The point on the transfer timeline where the batch's copies are done, submitting the batch if still open.
+        SyncToken Token(uint64_t batch)
+        {
+            std::lock_guard lock(mutex);
+            if (open.buffer && batch >= open.id)
+            {
+                return Submit();
+            }
+            for (auto& flushed : in_flight)
+            {
+                if (flushed.id >= batch)
+                {
+                    return SyncToken{transfer.Timeline(), flushed.value};
+                }
+            }
+            return SyncToken{};
+        }
+
+        // Records the acquire half of every ownership transfer flushed so far into a graphics command buffer. The
+        // submit of that command buffer has to wait on the returned token.
+        SyncToken Acquire(vk::CommandBuffer graphics)
+        {
+            std::lock_guard lock(mutex);
+            if (!buffer_acquires.empty() || !image_acquires.empty())
+            {
+                graphics.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, {}, {}, buffer_acquires, image_acquires);
+                buffer_acquires.clear();
+                image_acquires.clear();
+            }
+            if (last_flushed == 0)
+            {
+                return SyncToken{};
+            }
+            return SyncToken{transfer.Timeline(), last_flushed};
+        }
+
+        UploadStats GetStats()
+        {
+            std::lock_guard lock(mutex);
+            Retire();
+            return stats;
+        }
+    };
+};
+
+using UploadManager = std::shared_ptr<inner::UploadManager>;
+
+class UploadManagerBuilder
+{
+    private:
+    vk::DeviceSize m_Capacity = 16 * 1024 * 1024;
+    public:
+    auto SetStagingSize(vk::DeviceSize bytes)
+    {
+        m_Capacity = bytes;
+        return *this;
+    }
+
+    // transfer may be the same queue as graphics, in which case no ownership transfers are recorded.
+    auto Build(Queue transfer, Queue graphics)
+    {
+        return std::make_shared<inner::UploadManager>(transfer, graphics.Family(), CommandPoolBuilder().Build(transfer), m_Capacity);
+    }
+};
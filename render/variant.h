@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+#include "hash.h"
+#include "pipeline.h"
+
+namespace inner
+{
+    // Specialized pipelines built from one builder, keyed by their constant values. Each variant is
+    // compiled on the worker pool the first time it is asked for. With a fallback the generic pipeline (the shader's
+    // default constant values) is handed out until the variant is ready, without one the first Get blocks.
+    class PipelineVariants
+    {
+        private:
+        std::function<std::shared_ptr<Pipeline>(const SpecializationConstants&)> create;
+        std::shared_ptr<WorkerPool> workers;
+        std::shared_future<std::shared_ptr<Pipeline>> fallback;
+        std::unordered_map<HashKey, std::shared_future<std::shared_ptr<Pipeline>>> variants;
+        std::mutex mutex;
+
+        std::shared_future<std::shared_ptr<Pipeline>> Request(const SpecializationConstants& constants)
+        {
+            auto key = constants.Key();
+            std::lock_guard lock(mutex);
+            auto& variant = variants[key];
+            if (!variant.valid())
+            {
+                variant = workers->Submit([create = create, constants] { return create(constants); }).share();
+            }
+            return variant;
+        }
+
+        static bool Ready(const std::shared_future<std::shared_ptr<Pipeline>>& pipeline)
+        {
+            return pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+
+        public:
+        PipelineVariants(std::function<std::shared_ptr<Pipeline>(const SpecializationConstants&)> create, std::shared_ptr<WorkerPool> workers, bool use_fallback):
+        create(create), workers(workers)
+        {
+            if (use_fallback)
+            {
+                fallback = Request(SpecializationConstants());
+            }
+        }
+
+        std::shared_ptr<Pipeline> Get(const SpecializationConstants& constants)
+        {
+            auto variant = Request(constants);
+            if (fallback.valid() && !Ready(variant))
+            {
+                return fallback.get();
+            }
+            return variant.get();
+        }
+
+        // Starts compiling a variant ahead of its first use.
+        void Prewarm(const SpecializationConstants& constants)
+        {
+            Request(constants);
+        }
+
+        auto IsReady(const SpecializationConstants& constants)
+        {
+            return Ready(Request(constants));
+        }
+
+        auto Size()
+        {
+            std::lock_guard lock(mutex);
+            return variants.size();
+        }
+    };
+};
+
+using PipelineVariants = std::shared_ptr<inner::PipelineVariants>;
+
+class PipelineVariantsBuilder
+{
+    private:
+    bool m_Fallback = true;
+    public:
+    auto SetFallback(bool fallback)
+    {
+        m_Fallback = fallback;
+        return *this;
+    }
+
+    // The constants are applied to every stage in stages, replacing any the builder already set for those stages.
+    auto Build(GraphicsPipelineBuilder builder, Renderpass renderpass, uint32_t colorblend_count, vk::ShaderStageFlags stages, WorkerPool workers)
+    {
+        auto shared = std::make_shared<GraphicsPipelineBuilder>(std::move(builder));
+        return std::make_shared<inner::PipelineVariants>([shared, renderpass, colorblend_count, stages](const SpecializationConstants& constants) {
+            auto variant = *shared;
+            if (!constants.Empty())
+            {
+                variant = variant.SetSpecialization(stages, constants);
+            }
+            return variant.Build(renderpass, colorblend_count);
+        }, workers, m_Fallback);
+    }
+
+    auto Build(ComputePipelineBuilder builder, WorkerPool workers)
+    {
+        auto shared = std::make_shared<ComputePipelineBuilder>(std::move(builder));
+        return std::make_shared<inner::PipelineVariants>([shared](const SpecializationConstants& constants) {
+            auto variant = *shared;
+            if (!constants.Empty())
+            {
+                variant = variant.SetSpecialization(constants);
+            }
+            return variant.Build();
+        }, workers, m_Fallback);
+    }
+};
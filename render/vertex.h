@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__F16C__) || defined(__AVX2__)
+#define VERTEX_F16C
+#include <immintrin.h>
+#endif
+
+#include "vulkan/vulkan.hpp"
+
+struct Sfloat {};
+struct Snorm {};
+struct Unorm {};
+struct Sint {};
+struct Uint {};
+
+// One vertex attribute of N components stored as T and interpreted as Kind.
+template <typename Kind, typename T, uint32_t N>
+struct VertexComponents
+{
+    T data[N];
+};
+
+using Float2 = VertexComponents<Sfloat, float, 2>;
+using Float3 = VertexComponents<Sfloat, float, 3>;
+using Float4 = VertexComponents<Sfloat, float, 4>;
+using Int2 = VertexComponents<Sint, int32_t, 2>;
+using Int4 = VertexComponents<Sint, int32_t, 4>;
+using Half2 = VertexComponents<Sfloat, uint16_t, 2>;
+using Half4 = VertexComponents<Sfloat, uint16_t, 4>;
+using Snorm8x4 = VertexComponents<Snorm, int8_t, 4>;
+using Unorm8x4 = VertexComponents<Unorm, uint8_t, 4>;
+using Snorm16x2 = VertexComponents<Snorm, int16_t, 2>;
+using Snorm16x4 = VertexComponents<Snorm, int16_t, 4>;
+using Unorm16x2 = VertexComponents<Unorm, uint16_t, 2>;
+using Unorm16x4 = VertexComponents<Unorm, uint16_t, 4>;
+
+// xyz as 10 bit signed normalized values and a 2 bit w, the usual packing for normals and tangents.
+struct Snorm10x3
+{
+    uint32_t data;
+};
+
+template <typename T>
+struct VertexAttribute;
+
+template <>
+struct VertexAttribute<float>
+{
+    static constexpr vk::Format format = vk::Format::eR32Sfloat;
+};
+
+template <>
+struct VertexAttribute<int32_t>
+{
+    static constexpr vk::Format format = vk::Format::eR32Sint;
+};
+
+template <>
+struct VertexAttribute<uint32_t>
+{
+    static constexpr vk::Format format = vk::Format::eR32Uint;
+};
+
+template <>
+struct VertexAttribute<Snorm10x3>
+{
+    static constexpr vk::Format format = vk::Format::eA2B10G10R10SnormPack32;
+};
+
+template <typename Kind, typename T, uint32_t N>
+struct VertexAttribute<VertexComponents<Kind, T, N>>
+{
+    static constexpr vk::Format Select()
+    {
+        constexpr auto index = N - 1;
+        if constexpr (std::is_same_v<Kind, Sfloat> && std::is_same_v<T, float>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Sfloat> && std::is_same_v<T, uint16_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR16Sfloat, vk::Format::eR16G16Sfloat, vk::Format::eR16G16B16Sfloat, vk::Format::eR16G16B16A16Sfloat};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Sint> && std::is_same_v<T, int32_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Uint> && std::is_same_v<T, uint32_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Snorm> && std::is_same_v<T, int8_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR8Snorm, vk::Format::eR8G8Snorm, vk::Format::eR8G8B8Snorm, vk::Format::eR8G8B8A8Snorm};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Unorm> && std::is_same_v<T, uint8_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR8Unorm, vk::Format::eR8G8Unorm, vk::Format::eR8G8B8Unorm, vk::Format::eR8G8B8A8Unorm};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Snorm> && std::is_same_v<T, int16_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR16Snorm, vk::Format::eR16G16Snorm, vk::Format::eR16G16B16Snorm, vk::Format::eR16G16B16A16Snorm};
+            return formats[index];
+        }
+        else if constexpr (std::is_same_v<Kind, Unorm> && std::is_same_v<T, uint16_t>)
+        {
+            constexpr vk::Format formats[] = {vk::Format::eR16Unorm, vk::Format::eR16G16Unorm, vk::Format::eR16G16B16Unorm, vk::Format::eR16G16B16A16Unorm};
+            return formats[index];
+        }
+        else
+        {
+            static_assert(N == 0, "Unsupported vertex attribute");
+        }
+    }
+
+    static_assert(N >= 1 && N <= 4, "Vertex attributes have 1 to 4 components");
+    static constexpr vk::Format format = Select();
+};
+
+// Binding and attribute descriptions for a vertex made of the attributes Ts, in order. Offsets follow the
+// same alignment rules as a C++ struct with members of those types, so a matching struct can be used as storage.
+template <typename... Ts>
+struct VertexLayout
+{
+    private:
+    static constexpr auto Layout()
+    {
+        std::array<uint32_t, sizeof...(Ts)> offsets{};
+        constexpr uint32_t sizes[] = {sizeof(Ts)...};
+        constexpr uint32_t alignments[] = {alignof(Ts)...};
+        uint32_t offset = 0;
+        uint32_t alignment = 1;
+        for (size_t x = 0; x < sizeof...(Ts); x++)
+        {
+            offset = (offset + alignments[x] - 1) / alignments[x] * alignments[x];
+            offsets[x] = offset;
+            offset += sizes[x];
+            alignment = std::max(alignment, alignments[x]);
+        }
+        return std::pair(offsets, (offset + alignment - 1) / alignment * alignment);
+    }
+
+    public:
+    static constexpr uint32_t count = sizeof...(Ts);
+    static constexpr std::array<uint32_t, sizeof...(Ts)> offsets = Layout().first;
+    static constexpr uint32_t stride = Layout().second;
+    static constexpr std::array<vk::Format, sizeof...(Ts)> formats = {VertexAttribute<Ts>::format...};
+
+    // True when Vertex has the stride and its members, passed in attribute order, have the formats and offsets of
+    // this layout. Member offsets are only known at run time, use it in an assert rather than a static_assert.
+    template <typename Vertex, typename... Ms>
+    static bool Matches(Ms Vertex::*... members)
+    {
+        static_assert(sizeof...(Ms) == count, "Pass one member per attribute");
+        Vertex vertex{};
+        auto base = reinterpret_cast<const char*>(&vertex);
+        std::array<uint32_t, sizeof...(Ts)> member_offsets = {static_cast<uint32_t>(reinterpret_cast<const char*>(&(vertex.*members)) - base)...};
+        std::array<vk::Format, sizeof...(Ts)> member_formats = {VertexAttribute<Ms>::format...};
+        return sizeof(Vertex) == stride && member_offsets == offsets && member_formats == formats;
+    }
+
+    static auto Binding(uint32_t binding, vk::VertexInputRate rate = vk::VertexInputRate::eVertex)
+    {
+        return vk::VertexInputBindingDescription(binding, stride, rate);
+    }
+
+    static auto Attributes(uint32_t binding, uint32_t first_location = 0)
+    {
+        std::array<vk::VertexInputAttributeDescription, sizeof...(Ts)> attributes;
+        for (uint32_t x = 0; x < count; x++)
+        {
+            attributes[x] = vk::VertexInputAttributeDescription(first_location + x, binding, formats[x], offsets[x]);
+        }
+        return attributes;
+    }
+};
+
+inline uint16_t PackHalf(float value)
+{
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint16_t half;
+    if (x >= 0x47800000u)
+    {
+        half = x > 0x7F800000u ? 0x7E00 : 0x7C00;
+    }
+    else if (x < 0x38800000u)
+    {
+        // Adding the magic value lines the 10 mantissa bits up at the bottom, the FPU does the rounding.
+        float f;
+        uint32_t magic = 126u << 23;
+        std::memcpy(&f, &x, sizeof(f));
+        float m;
+        std::memcpy(&m, &magic, sizeof(m));
+        f += m;
+        std::memcpy(&x, &f, sizeof(x));
+        half = (uint16_t)(x - magic);
+    }
+    else
+    {
+        uint32_t odd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xFFF + odd;
+        half = (uint16_t)(x >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+}
+
+inline uint32_t PackSnorm10x3(float x, float y, float z)
+{
+    auto pack = [](float v) {
+        return (uint32_t)(int32_t)std::nearbyint(std::clamp(v, -1.0f, 1.0f) * 511.0f) & 0x3FF;
+    };
+    return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
+
+// Bulk converters from float source data, count is the number of floats (or xyz triples for PackSnorm10x3).
+inline void PackHalf(const float* src, uint16_t* dst, size_t count)
+{
+    size_t x = 0;
+#ifdef VERTEX_F16C
+    for (; x + 8 <= count; x += 8)
+    {
+        auto h = _mm256_cvtps_ph(_mm256_loadu_ps(src + x), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), h);
+    }
+#endif
+    for (; x < count; x++)
+    {
+        dst[x] = PackHalf(src[x]);
+    }
+}
+
+inline void PackSnorm8(const float* src, int8_t* dst, size_t count)
+{
+    size_t x = 0;
+#ifdef VERTEX_SSE2
+    auto lo = _mm_set1_ps(-1.0f);
+    auto hi = _mm_set1_ps(1.0f);
+    auto scale = _mm_set1_ps(127.0f);
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i v[4];
+        for (int i = 0; i < 4; i++)
+        {
+            auto f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x + i * 4), lo), hi);
+            v[i] = _mm_cvtps_epi32(_mm_mul_ps(f, scale));
+        }
+        auto packed = _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), packed);
+    }
+#endif
+    for (; x < count; x++)
+    {
+        dst[x] = (int8_t)std::nearbyint(std::clamp(src[x], -1.0f, 1.0f) * 127.0f);
+    }
+}
+
+inline void PackUnorm8(const float* src, uint8_t* dst, size_t count)
+{
+    size_t x = 0;
+#ifdef VERTEX_SSE2
+    auto lo = _mm_setzero_ps();
+    auto hi = _mm_set1_ps(1.0f);
+    auto scale = _mm_set1_ps(255.0f);
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i v[4];
+        for (int i = 0; i < 4; i++)
+        {
+            auto f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x + i * 4), lo), hi);
+            v[i] = _mm_cvtps_epi32(_mm_mul_ps(f, scale));
+        }
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), packed);
+    }
+#endif
+    for (; x < count; x++)
+    {
+        dst[x] = (uint8_t)std::nearbyint(std::clamp(src[x], 0.0f, 1.0f) * 255.0f);
+    }
+}
+
+inline void PackSnorm16(const float* src, int16_t* dst, size_t count)
+{
+    size_t x = 0;
+#ifdef VERTEX_SSE2
+    auto lo = _mm_set1_ps(-1.0f);
+    auto hi = _mm_set1_ps(1.0f);
+    auto scale = _mm_set1_ps(32767.0f);
+    for (; x + 8 <= count; x += 8)
+    {
+        auto a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x), lo), hi), scale));
+        auto b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x + 4), lo), hi), scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; x < count; x++)
+    {
+        dst[x] = (int16_t)std::nearbyint(std::clamp(src[x], -1.0f, 1.0f) * 32767.0f);
+    }
+}
+
+inline void PackUnorm16(const float* src, uint16_t* dst, size_t count)
+{
+    size_t x = 0;
+#ifdef VERTEX_SSE2
+    auto lo = _mm_setzero_ps();
+    auto hi = _mm_set1_ps(1.0f);
+    auto scale = _mm_set1_ps(65535.0f);
+    auto bias = _mm_set1_epi32(32768);
+    auto flip = _mm_set1_epi16((short)0x8000);
+    for (; x + 8 <= count; x += 8)
+    {
+        // SSE2 only has a signed 32 to 16 bit pack, so shift into signed range and flip the top bit back afterwards.
+        auto a = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x), lo), hi), scale)), bias);
+        auto b = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x + 4), lo), hi), scale)), bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+    }
+#endif
+    for (; x < count; x++)
+    {
+        dst[x] = (uint16_t)std::nearbyint(std::clamp(src[x], 0.0f, 1.0f) * 65535.0f);
+    }
+}
+
+inline void PackSnorm10x3(const float* src, uint32_t* dst, size_t count)
+{
+    for (size_t x = 0; x < count; x++)
+    {
+        dst[x] = PackSnorm10x3(src[x * 3], src[x * 3 + 1], src[x * 3 + 2]);
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace inner
+{
+    class WorkerPool
+    {
+        private:
+        std::vector<std::thread> threads;
+        std::queue<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stop = false;
+
+        void Run()
+        {
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock lock(mutex);
+                    condition.wait(lock, [&] { return stop || !jobs.empty(); });
+                    if (stop && jobs.empty())
+                    {
+                        return;
+                    }
+                    job = std::move(jobs.front());
+                    jobs.pop();
+                }
+                job();
+            }
+        }
+
+        public:
+        WorkerPool(uint32_t count)
+        {
+            for (uint32_t x = 0; x < count; x++)
+            {
+                threads.emplace_back([this] { Run(); });
+            }
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard lock(mutex);
+                stop = true;
+            }
+            condition.notify_all();
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        template <typename F>
+        auto Submit(F&& job)
+        {
+            using Result = std::invoke_result_t<F>;
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+            auto future = task->get_future();
+            {
+                std::lock_guard lock(mutex);
+                jobs.emplace([task] { (*task)(); });
+            }
+            condition.notify_one();
+            return future;
+        }
+
+        auto Size()
+        {
+            return (uint32_t)threads.size();
+        }
+    };
+};
+
+using WorkerPool = std::shared_ptr<inner::WorkerPool>;
+
+class WorkerPoolBuilder
+{
+    private:
+    uint32_t m_Threads = std::max(1u, std::thread::hardware_concurrency());
+    public:
+    auto SetThreadCount(uint32_t threads)
+    {
+        m_Threads = std::max(1u, threads);
+        return *this;
+    }
+
+    auto Build()
+    {
+        return std::make_shared<inner::WorkerPool>(m_Threads);
+    }
+};